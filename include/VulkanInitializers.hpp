@@ -11,7 +11,7 @@
 #pragma once
 
 #include <vector>
-#include "vulkan/vulkan.h"
+#include "vulkanLoader.h"
 
 namespace vks
 {
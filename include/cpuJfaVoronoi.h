@@ -0,0 +1,44 @@
+#ifndef CPU_JFA_VORONOI_H
+#define CPU_JFA_VORONOI_H
+
+#include "voronoi.h"
+#include "voronoiEngine.h"
+#include "utils.h"
+#include "workerPool.h"
+
+#include "CImg.h"
+#include <vector>
+#include "glm/glm.hpp"
+#include "glm/vec2.hpp"
+
+#define CPU_JFA_BLOCK 64 // pixels a side of the square blocks handed to each thread
+
+// jump flooding on the host, for machines without a Vulkan device; the same
+// passes as JFAVoronoi, each split into square blocks shared out to the
+// threads. Only steps shorter than a block keep most of a block's reads
+// inside it, the long early steps read far outside, so the blocking mostly
+// pays off in the final few passes. Labels are left in one of two buffers
+// that live as long as the engine, and the label map is a view straight into it
+class CPUJFAVoronoi : public VoronoiEngine {
+  private:
+    WorkerPool workers;
+    std::vector<uint32_t> labels[2]; // ping-pong, one label per pixel
+    std::vector<glm::vec2> sites; // in pixels
+    int width, height;
+    uint32_t blocksX, blocksY;
+
+    void Seed(uint32_t* destination);
+    void Step(const uint32_t* source, uint32_t* destination, int step, uint32_t block);
+    uint32_t Flood();
+
+  public:
+    using VoronoiEngine::GetLabelMap;
+
+    cimg_library::CImg<uint32_t> GetImage(const std::vector<glm::vec2>& points) override;
+    LabelMap GetLabelMap(const std::vector<glm::vec2>& points) override;
+
+    // zero threads takes one per hardware thread
+    CPUJFAVoronoi(int _width, int _height, uint32_t threads = 0);
+};
+
+#endif
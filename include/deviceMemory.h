@@ -0,0 +1,111 @@
+#ifndef DEVICE_MEMORY_H
+#define DEVICE_MEMORY_H
+
+#include "vulkanLoader.h"
+#include <cstdint>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#define MEMORY_BLOCK_SIZE (64ull << 20) // bytes per block of one memory type
+#define MEMORY_DEDICATED_SIZE (MEMORY_BLOCK_SIZE / 2) // larger requests get a block of their own
+
+class VulkanContext;
+
+// one vkAllocateMemory, shared by every allocation carved from it
+struct MemoryBlock {
+  VkDeviceMemory memory;
+  VkDeviceSize size;
+  unsigned char* mapped = nullptr; // the whole block, host visible types only
+  std::map<VkDeviceSize, VkDeviceSize> free; // offset to size, neighbours merged
+  uint32_t allocations = 0;
+  bool dedicated;
+};
+
+// a range of a block; host visible ranges are mapped for as long as they live
+struct MemoryAllocation {
+  MemoryBlock* block = nullptr;
+  uint32_t typeIndex;
+  bool linear;
+  VkDeviceSize offset = 0;
+  VkDeviceSize size = 0;
+  void* mapped = nullptr;
+  bool coherent = true;
+};
+
+// sub-allocates device memory from large blocks per memory type, first fit
+// over a free list per block; buffers and optimally tiled images are kept
+// in separate blocks so bufferImageGranularity never applies
+class MemoryAllocator {
+  private:
+    VkDevice device;
+    VkPhysicalDeviceMemoryProperties memoryProperties;
+    VkDeviceSize nonCoherentAtomSize;
+    std::mutex mutex;
+    std::vector<std::list<MemoryBlock>> pools[2]; // [linear][memory type]
+
+    MemoryBlock* CreateBlock(uint32_t typeIndex, bool linear, VkDeviceSize size, bool dedicated);
+    static bool Carve(MemoryBlock& block, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize* offset);
+
+  public:
+    void Init(VkPhysicalDevice physicalDevice, VkDevice device);
+    MemoryAllocation Allocate(const VkMemoryRequirements& requirements, uint32_t typeIndex, bool linear);
+    void Free(MemoryAllocation& allocation);
+    void Flush(const MemoryAllocation& allocation);
+    void Invalidate(const MemoryAllocation& allocation);
+    void Release();
+};
+
+
+// a buffer bound to its own range of a block, both released on destruction;
+// converts to VkBuffer wherever a handle is expected
+class DeviceBuffer {
+  private:
+    std::shared_ptr<VulkanContext> context;
+    MemoryAllocation allocation;
+
+  public:
+    VkBuffer buffer = VK_NULL_HANDLE;
+
+    DeviceBuffer() {}
+    DeviceBuffer(std::shared_ptr<VulkanContext> context, VkBuffer buffer, const MemoryAllocation& allocation);
+    DeviceBuffer(DeviceBuffer&& other) noexcept;
+    DeviceBuffer& operator=(DeviceBuffer&& other) noexcept;
+    DeviceBuffer(const DeviceBuffer&) = delete;
+    DeviceBuffer& operator=(const DeviceBuffer&) = delete;
+    ~DeviceBuffer() { Reset(); }
+
+    void Reset();
+    void Flush() const;
+    void Invalidate() const;
+    void* Mapped() const { return allocation.mapped; }
+    bool Coherent() const { return allocation.coherent; }
+    VkDeviceSize Size() const { return allocation.size; }
+    operator VkBuffer() const { return buffer; }
+};
+
+
+// an image and view bound to their own range of a block
+class DeviceImage {
+  private:
+    std::shared_ptr<VulkanContext> context;
+    MemoryAllocation allocation;
+
+  public:
+    VkImage image = VK_NULL_HANDLE;
+    VkImageView view = VK_NULL_HANDLE;
+
+    DeviceImage() {}
+    DeviceImage(std::shared_ptr<VulkanContext> context, VkImage image, VkImageView view, const MemoryAllocation& allocation);
+    DeviceImage(DeviceImage&& other) noexcept;
+    DeviceImage& operator=(DeviceImage&& other) noexcept;
+    DeviceImage(const DeviceImage&) = delete;
+    DeviceImage& operator=(const DeviceImage&) = delete;
+    ~DeviceImage() { Reset(); }
+
+    void Reset();
+};
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef DISC_RENDERER_H
+#define DISC_RENDERER_H
+
+#include "utils.h"
+#include "headlessVulkan.h"
+
+#include "CImg.h"
+#include <array>
+#include <vector>
+#include "glm/glm.hpp"
+#include "glm/vec2.hpp"
+#include "glm/vec3.hpp"
+
+#define DISC_BUFFER_INCREMENT 1000
+
+// per-instance disc data, std layout of the disc.vert inputs
+struct DiscInstance {
+  glm::vec2 position; // fraction of the image
+  float radius; // output pixels
+  uint32_t color; // RGBA8, red in the low byte
+};
+
+inline uint32_t PackColor(const glm::vec3& color, float alpha = 255.0f) {
+  const glm::uvec4 channels = glm::uvec4(glm::clamp(glm::vec4(color, alpha), 0.0f, 255.0f) + 0.5f);
+  return channels.r | channels.g << 8 | channels.b << 16 | channels.a << 24;
+}
+
+// final stipple render as antialiased instanced discs, blended in order over
+// the background; outputs larger than the framebuffer limit are tiled like
+// the label render
+class DiscRenderer {
+  private:
+    HeadlessVulkan* vulkan;
+    DeviceBuffer quadBuffer;
+    DeviceBuffer instanceBuffer; // host visible, mapped, grown geometrically
+    DiscInstance* instances = nullptr;
+    uint32_t instanceCapacity = 0;
+    std::array<VkVertexInputBindingDescription, 2> bindings;
+    std::array<VkVertexInputAttributeDescription, 3> attributes;
+    int width, height;
+
+    VkPipelineVertexInputStateCreateInfo GetVertexInputState();
+    void GenerateInstanceBuffer(uint32_t len);
+
+  public:
+    DiscRenderer(int width, int height);
+    ~DiscRenderer();
+
+    DiscRenderer(const DiscRenderer&) = delete;
+    DiscRenderer& operator=(const DiscRenderer&) = delete;
+
+    // background and disc colours are 0-255 per channel
+    cimg_library::CImg<unsigned char> Render(const std::vector<DiscInstance>& discs, const glm::vec3& background);
+};
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef EDT_VORONOI_H
+#define EDT_VORONOI_H
+
+#include "voronoi.h"
+#include "voronoiEngine.h"
+#include "utils.h"
+#include "workerPool.h"
+
+#include "CImg.h"
+#include <vector>
+#include "glm/glm.hpp"
+#include "glm/vec2.hpp"
+
+#define EDT_COLUMN_STRIP 16 // adjacent columns per task of the column pass
+
+// labels from a separable Euclidean distance transform: a row pass finds
+// the nearest seed along each row, and a column pass takes the lower
+// envelope of the parabolas those rows leave behind (Felzenszwalb and
+// Huttenlocher). Every site is snapped to the centre of the pixel holding
+// it, as JFAVoronoi seeds them, and the result is the exact diagram of
+// those seeds, ties between equally near seeds going either way. It is not
+// the diagram of the sites themselves: a label may be up to sqrt(2) pixels
+// farther than the nearest site, and of sites sharing a pixel only the
+// lowest index is seeded, the others get no cell. O(width * height)
+// whatever the number of sites; rows and then columns are shared out to the
+// worker pool, and the labels are the same however the work is split
+class EDTVoronoi : public VoronoiEngine {
+  private:
+    WorkerPool workers;
+    int width, height;
+
+    std::vector<uint32_t> seeds; // site per pixel, the lowest index where sites share one
+    std::vector<int64_t> rowDistances; // squared, to the nearest seed in the row
+    std::vector<uint32_t> rowLabels;
+    std::vector<uint32_t> labels;
+
+    void Seed(const std::vector<glm::vec2>& points);
+    void RowPass(int y);
+    void ColumnPass(int x, std::vector<int>& parabolas, std::vector<double>& bounds);
+
+  public:
+    using VoronoiEngine::GetLabelMap;
+
+    cimg_library::CImg<uint32_t> GetImage(const std::vector<glm::vec2>& points) override;
+    LabelMap GetLabelMap(const std::vector<glm::vec2>& points) override;
+
+    // zero threads takes one per hardware thread
+    EDTVoronoi(int _width, int _height, uint32_t threads = 0);
+};
+
+#endif
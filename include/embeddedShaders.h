@@ -0,0 +1,21 @@
+#ifndef EMBEDDED_SHADERS_H
+#define EMBEDDED_SHADERS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// environment variable naming a directory to load SPIR-V from instead of the
+// copies compiled into the binary
+#define SHADER_PATH_ENV "LBG_SHADER_PATH"
+
+struct EmbeddedShader {
+  const char* name; // SPIR-V file name, e.g. "moments.comp.spv"
+  const uint32_t* code;
+  size_t size; // bytes
+};
+
+// the shader compiled into the binary under `name`, or nullptr
+const EmbeddedShader* FindEmbeddedShader(const std::string& name);
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef ENGINE_REGISTRY_H
+#define ENGINE_REGISTRY_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "voronoi.h"
+#include "voronoiEngine.h"
+#include "gpuVoronoi.h"
+#include "CImg.h"
+#include "glm/glm.hpp"
+#include "glm/vec2.hpp"
+
+#define ENGINE_BENCHMARK_SIZE 512 // pixels a side of the crop engines are timed on
+#define ENGINE_BENCHMARK_CAP_MS 1000.0 // a warm up slower than this is the engine's time
+#define ENGINE_MEMORY_SHARE 2 // an engine may take up to 1 / share of physical memory
+
+// an engine that can be forced by name or picked by benchmark
+struct EngineEntry {
+  const char* name; // as given on the command line
+  EngineType type;
+  VoronoiMode mode; // raster engine only
+  bool device; // needs a Vulkan device
+  bool selectable; // every site keeps a cell within a pixel of its true one, so Auto may pick it
+  size_t bytesPerPixel; // host memory at full size, roughly
+  VoronoiEngine* (*create)(int width, int height, uint32_t maxPoints);
+};
+
+// every engine in the tree, device engines first
+const std::vector<EngineEntry>& GetEngines();
+
+// nullptr when nothing matches
+const EngineEntry* FindEngine(const std::string& name);
+const EngineEntry* FindEngine(EngineType type, VoronoiMode mode);
+
+// host engines always are, device engines when a Vulkan device answers
+bool EngineAvailable(const EngineEntry& entry);
+
+// builds an engine, destroying its device surface with it rather than
+// pooling it, as benchmarks want
+VoronoiEngine* CreateUnpooledEngine(const EngineEntry& entry, int width, int height, uint32_t maxPoints);
+
+// milliseconds for one iteration of the diagram and its moments, reduced
+// by the engine when it can and from the streamed label map otherwise, as
+// StippleImage::Iterate makes them; one warm up, then one timed run unless
+// the warm up overran ENGINE_BENCHMARK_CAP_MS. The density must be set
+double BenchmarkEngine(VoronoiEngine* engine, const cimg_library::CImg<unsigned char>& img,
+                       const std::vector<glm::vec2>& points, const std::vector<float>& radii);
+
+// times every available, selectable engine whose footprint at width x
+// height fits the memory share on a crop of the image holding sites at the full image's
+// density, one engine alive at a time; engines that fail to build or run
+// are passed over
+const EngineEntry& SelectEngine(const cimg_library::CImg<unsigned char>& crop, const std::vector<glm::vec2>& points,
+                                const std::vector<float>& radii, int width, int height);
+
+#endif
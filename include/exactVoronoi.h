@@ -0,0 +1,68 @@
+#ifndef EXACT_VORONOI_H
+#define EXACT_VORONOI_H
+
+#include "voronoi.h"
+#include "voronoiEngine.h"
+#include "utils.h"
+#include "workerPool.h"
+
+#include "CImg.h"
+#include <vector>
+#include "glm/glm.hpp"
+#include "glm/vec2.hpp"
+
+#define EXACT_SITES_PER_BIN 2 // average sites in a bin of the site grid
+#define EXACT_SITE_CHUNK 256 // sites per task handed to the worker pool
+#define EXACT_PREFIX_BLOCK 64 // pixels per block of the float prefix sums
+
+// Voronoi cells as exact polygons rather than pixels: each site's cell is
+// the image rectangle clipped by the bisectors of its neighbours, found by
+// searching a grid of sites ring by ring until no further site can reach
+// the cell. Moments are integrated over each polygon's scanline spans from
+// per row prefix sums of the density, so an iteration costs the rows cells
+// cover rather than every pixel. A pixel belongs to the cell holding its
+// centre, as for the raster engines
+class ExactVoronoi : public VoronoiEngine {
+  private:
+    WorkerPool workers;
+    int width, height;
+
+    // per row prefix sums of density, density * x and density * x^2 in
+    // blocks: each block keeps double sums of the row before it and float
+    // sums from its own start, with x counted from there too, so the floats
+    // stay small enough to keep their precision. 12 bytes per pixel plus 24
+    // per block, rows hold width + 1 entries starting from zero
+    std::vector<glm::vec3> partials;
+    std::vector<glm::dvec3> bases;
+    int blocksPerRow;
+
+    glm::dvec3 Prefix(int y, int x) const;
+
+    // sites in pixels, counting sorted into square bins
+    std::vector<glm::dvec2> sites;
+    int binsX, binsY;
+    double binSize;
+    std::vector<uint32_t> binStarts; // binsX * binsY + 1 offsets into binSites
+    std::vector<uint32_t> binSites;
+
+    std::vector<uint32_t> labels; // spans filled in, for GetLabelMap only
+
+    void BuildGrid(const std::vector<glm::vec2>& points);
+    std::vector<glm::dvec2> GetCellPolygon(uint32_t site);
+    VoronoiCell IntegrateCell(const std::vector<glm::dvec2>& polygon);
+
+  public:
+    using VoronoiEngine::GetLabelMap;
+
+    cimg_library::CImg<uint32_t> GetImage(const std::vector<glm::vec2>& points) override;
+    LabelMap GetLabelMap(const std::vector<glm::vec2>& points) override;
+
+    bool SupportsMoments() const override { return true; }
+    void SetDensity(const cimg_library::CImg<unsigned char>& img) override;
+    std::vector<VoronoiCell> GetCells(const std::vector<glm::vec2>& points, const std::vector<float>& radii) override;
+
+    // zero threads takes one per hardware thread
+    ExactVoronoi(int _width, int _height, uint32_t threads = 0);
+};
+
+#endif
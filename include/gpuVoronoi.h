@@ -1,6 +1,8 @@
 #ifndef GPU_VORONOI_H
 #define GPU_VORONOI_H
 
+#include "voronoi.h"
+#include "voronoiEngine.h"
 #include "utils.h"
 #include "headlessVulkan.h"
 
@@ -11,58 +13,187 @@
 #include "glm/vec3.hpp"
 #include "glm/vec2.hpp"
 #include <iostream>
+#include <cmath>
+#include <tuple>
 
 #define BUFFER_INCREMENT 1000
+#define MIN_CONE_RADIUS 8.0f // pixels, reach of the finest level of detail
+#define RESIDENT_COUNTERS 5 // count, next, changes, requested and reach of lbgDecide.comp
 
-class GPUVoronoi {
+// how each site's distance field is rasterised
+enum class VoronoiMode {
+  Cones, // tessellated cones, depth interpolated from the mesh
+  Quads  // bounded quads, exact distance written per fragment
+};
+
+// per-instance cone data; labels are carried explicitly since instances are
+// grouped by level of detail rather than drawn in stipple order
+struct ConeInstance {
+  glm::vec2 position;
+  float radius; // x axis device units
+  uint32_t label;
+};
+
+// std430 parameters of lbgDecide.comp
+struct ResidentParams {
+  float lower, upper, jitter, margin;
+  float radius; // reaches across the image, no cone is drawn larger
+  int32_t width, height;
+  uint32_t seed, capacity;
+};
+
+// a unit cone tessellated finely enough for radii up to `radius`, and the
+// instances drawn with it this frame
+struct ConeLOD {
+  float radius = 0.0f;
+  DeviceBuffer coneBuffer, instanceBuffer;
+  uint32_t coneBufferSize = 0;
+  uint32_t instanceBufferSize = 0;
+  ConeInstance* instances = nullptr; // persistently mapped, host coherent
+  DeviceBuffer layerBuffer; // layered surfaces only, one index per instance
+  uint32_t* instanceLayers = nullptr;
+  uint32_t instanceCount = 0;
+};
+
+// device objects of a GPUVoronoi that depend only on its resolution, label
+// format and mode; destroyed solvers hand theirs on to the next one alike
+struct VoronoiSurface {
+  HeadlessVulkan* vulkan;
+  std::vector<ConeLOD> lods;
+};
+
+typedef std::tuple<int, int, VkFormat, VoronoiMode, uint32_t> SurfaceKey;
+
+class GPUVoronoi : public VoronoiEngine {
   private:
-    VkBuffer coneBuffer, colorBuffer, positionBuffer;
-    VkDeviceMemory coneMemory, colorMemory, posMemory;
+    VoronoiMode mode;
+    SurfaceKey surfaceKey;
+    std::vector<ConeLOD> lods;
+    uint32_t layers;
     std::array<VkVertexInputBindingDescription, 3> bindings;
-    std::array<VkVertexInputAttributeDescription, 3> attributes;
-
-    static uint8_t ConeSlices(const float& radius, const float& epsilon);
-    std::vector<glm::vec3> GenerateConeData();
-    void GenerateConeBuffer();
-    void GenerateColorBuffer(uint32_t len);
+    std::array<VkVertexInputAttributeDescription, 4> attributes;
+
+    static uint32_t ConeSlices(const float& radius, const float& epsilon);
+    std::vector<glm::vec3> GenerateConeData(float radius);
+    std::vector<glm::vec3> GenerateQuadData();
+    void GenerateConeLODs();
+    void GenerateInstanceBuffer(ConeLOD& lod, uint32_t len);
+    uint32_t GetLODIndex(float radius);
+    void UploadPoints(const std::vector<glm::vec2>& points, const std::vector<float>& radii);
+    void UploadInstances(const std::vector<glm::vec2>& points, const std::vector<float>& radii, const std::vector<uint32_t>& layerStarts);
+    std::vector<DrawBatch> GetBatches();
+    bool IsCovered(const LabelMap& map, const LabelRegion& region);
+    std::vector<VoronoiCell> ReduceMoments(uint32_t cells, double* coveredArea);
+    bool AcquireSurface();
+    void ReleaseSurface();
 
     HeadlessVulkan* computePipeline;
-
-    uint32_t colorBufferSize = 0;
-    uint32_t coneBufferSize = 0;
+    bool keepSurface = true; // pooled for the next solver of this size on destruction
+
+    // device resident iterations; instances are drawn from residentPoints[0]
+    // and lbgDecide.comp compacts the next set into residentPoints[1]
+    ComputePipeline lbg;
+    DeviceBuffer residentPoints[2];
+    DeviceBuffer counterBuffer, counterReadback; // count, next, changes, requested, reach
+    const uint32_t* counters;
+    DeviceBuffer paramBuffer;
+    ResidentParams* residentParams;
+    VkCommandBuffer lbgCommand = VK_NULL_HANDLE;
+    uint32_t residentCapacity = 0;
+    uint32_t residentSeed = 0;
+    uint32_t residentCount = 0; // points drawn next, as of the last iteration
+    float residentReach; // the largest of their radii
+    bool residentFirst;
+
+    void RecordResident();
+    void FreeResident();
+
+    float fullRadius; // reaches every pixel from anywhere in the image
+    float depthRange;
     int width, height;
   
   public:
     VkPipelineVertexInputStateCreateInfo GetVertexInputState();
-    void DrawCones(std::vector<glm::vec2> points);
-    cimg_library::CImg<unsigned char> GetImage();
-    cimg_library::CImg<unsigned char> GetImage(const std::vector<glm::vec2> &points);
-
+    void DrawCones(const std::vector<glm::vec2>& points);
+    cimg_library::CImg<uint32_t> GetImage();
+    cimg_library::CImg<uint32_t> GetImage(const std::vector<glm::vec2> &points) override;
+    LabelMap GetLabelMap(const std::vector<glm::vec2> &points) override;
+    LabelMap GetLabelMap(const std::vector<glm::vec2> &points, const std::vector<float> &radii) override;
+    std::vector<LabelMap> GetLabelMaps(const std::vector<std::vector<glm::vec2>>& pointSets);
+    LabelMap StreamLabelMap(const std::vector<glm::vec2>& points, const std::vector<float>& radii, const LabelBandCallback& band) override;
+    bool SupportsMoments() const override { return computePipeline->SupportsMoments(); }
+    void SetDensity(const cimg_library::CImg<unsigned char>& img) override;
+    std::vector<VoronoiCell> GetCells(const std::vector<glm::vec2> &points, const std::vector<float> &radii) override;
+
+    bool SupportsResident() const override { return SupportsMoments(); }
+    void BeginResident(const std::vector<glm::vec2>& points, uint32_t capacity) override;
+    void IterateResident(const ResidentBounds& bounds, uint32_t* count, uint32_t* changes) override;
+    std::vector<glm::vec2> ReadPoints() override;
+    DeviceTimings TakeTimings() override { return computePipeline->TakeTimings(); }
+
+    // the logical device and queue this solver submits to
+    std::pair<uint32_t, uint32_t> GetQueue() const { return {computePipeline->DeviceOrdinal(), computePipeline->QueueIndex()}; }
+
+    // false destroys the surface with the solver rather than pooling it, for
+    // sizes no later solver will ask for
+    void KeepSurface(bool keep) { keepSurface = keep; }
 
     GPUVoronoi() {};
 
-    GPUVoronoi(int _width, int _height) {
+    // maxPoints bounds the number of stipples ever drawn at once; when every
+    // index fits in 16 bits the label attachment and readback are halved.
+    // More than one layer lets GetLabelMaps solve that many point sets of
+    // the same size in one submission, maxPoints then bounds each set
+    GPUVoronoi(int _width, int _height, uint32_t maxPoints = 0, VoronoiMode _mode = VoronoiMode::Cones, uint32_t _layers = 1) {
       width = _width;
       height = _height;
+      mode = _mode;
+      layers = std::max<uint32_t>(_layers, 1);
 
-      VkPipelineVertexInputStateCreateInfo inputState =  GetVertexInputState();
+      // distances are measured in x axis device units, the image diagonal
+      // is the furthest any pixel can be from its site
+      const float aspect = static_cast<float>(width) / height;
+      fullRadius = 2.0f * std::sqrt(1.0f + 1.0f / (aspect * aspect));
+      depthRange = 1.01f * fullRadius;
 
-      computePipeline = new HeadlessVulkan( width, height, inputState );
+      VkPipelineVertexInputStateCreateInfo inputState =  GetVertexInputState();
 
-      // create primitive geometry 
-      GenerateConeBuffer();
-      GenerateColorBuffer(BUFFER_INCREMENT);
+      // 0xffff is reserved for uncovered pixels
+      VkFormat labelFormat = (maxPoints > 0 && maxPoints < 0xffff) ? VK_FORMAT_R16_UINT : VK_FORMAT_R32_UINT;
+
+      PipelineShaders shaders;
+      if(mode == VoronoiMode::Quads) {
+        shaders.vertex = "quad.vert.spv";
+        shaders.fragment = "quad.frag.spv";
+        shaders.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP;
+      }
+
+      // the layered variants read each instance's layer from its own stream
+      if(layers > 1) {
+        shaders.vertex = mode == VoronoiMode::Quads ? "quad.layered.vert.spv" : "layered.vert.spv";
+      }
+
+      // a released surface of the same size skips the framebuffer, pipeline
+      // and cone meshes entirely
+      surfaceKey = SurfaceKey(width, height, labelFormat, mode, layers);
+      if(!AcquireSurface()) {
+        computePipeline = new HeadlessVulkan( width, height, inputState, labelFormat, shaders, layers );
+
+        // create primitive geometry 
+        GenerateConeLODs();
+      }
     }
 
-    ~GPUVoronoi() {
+    ~GPUVoronoi() override {
       std::cout << "gv destructor" << std::endl;
-      VkDevice device = computePipeline->GetDevice();
-      vkDestroyBuffer(device, coneBuffer, nullptr);
-      vkDestroyBuffer(device, colorBuffer, nullptr);
 
-      vkFreeMemory(device, coneMemory, nullptr);
-      vkFreeMemory(device, colorMemory, nullptr);
-      delete computePipeline;
+      FreeResident();
+      computePipeline->DestroyComputePipeline(lbg);
+      if(lbgCommand != VK_NULL_HANDLE) {
+        computePipeline->FreeCommandBuffer(lbgCommand);
+      }
+
+      ReleaseSurface();
     }
 
 };
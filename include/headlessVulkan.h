@@ -1,7 +1,8 @@
 #ifndef HEADLESS_VULKAN_H
 #define HEADLESS_VULKAN_H
 
-#include <vulkan/vulkan.h>
+#include "vulkanLoader.h"
+#include <chrono>
 #include <fstream>
 #include <iostream>
 #include <functional>
@@ -10,7 +11,9 @@
 #include <optional>
 #include <string>
 #include <vector>
+#include <algorithm>
 #include <cstdint>
+#include <map>
 
 #include "CImg.h"
 #include <glm/vec2.hpp> // glm::vec2
@@ -21,103 +24,345 @@
 #include <glm/gtc/matrix_transform.hpp> // Only for demo code
 
 #include "VulkanInitializers.hpp"
+#include "vulkanContext.h"
+#include "embeddedShaders.h"
+#include "utils.h"
 
-#define SHADER_PATH "resources/shaders/"
-
-#define VK_CHECK_RESULT(f) \
-{\
-  VkResult res = (f);\
-  if (res != VK_SUCCESS) \
-  {\
-    std::cout << "Fatal : Error in " << __FILE__ << " at line " << __LINE__ << " with code " << res << std::endl;\
-    assert(res == VK_SUCCESS);\
-  }\
-}
-
-#define LOG(...) printf(__VA_ARGS__)
-
-static VKAPI_ATTR VkBool32 VKAPI_CALL debugMessageCallback(
-    VkDebugReportFlagsEXT flags,
-    VkDebugReportObjectTypeEXT objectType,
-    uint64_t object,
-    size_t location,
-    int32_t messageCode,
-    const char* pLayerPrefix,
-    const char* pMessage,
-    void* pUserData)
-{
-  LOG("[VALIDATION]: %s - %s\n", pLayerPrefix, pMessage);
-  return VK_FALSE;
-}
+#define COMMAND_BUFFER_COUNT 4
+#define MAX_DRAW_BATCHES 16
+#define MAX_TILE_SIZE 4096 // framebuffer side, larger images are rendered in tiles
+#define READBACK_BAND_ROWS 256 // rows per band of a streamed readback
+
+// per cell moments reduced on the device: area, m00, m10, m01, m11, m20, m02
+#define MOMENT_COUNT 7
+#define MOMENT_GROUP_SIZE 64 // matches local_size_x in moments.comp
+#define MOMENT_RUN_LENGTH 16 // pixels of a row walked by one invocation
+
+// one instanced draw within the render pass; batches are drawn in order
+struct DrawBatch {
+  std::vector<VkBuffer> buffers; // bound from binding 0
+  uint32_t vertexCount;
+  uint32_t instanceCount;
+  bool deviceCount = false; // instanceCount is written on the device instead
+};
+
+
+// shader stages and primitive assembly of the graphics pipeline, shaders are
+// named by their SPIR-V file and found by LoadShader
+struct PipelineShaders {
+  std::string vertex = "vert.spv";
+  std::string fragment = "frag.spv";
+  VkPrimitiveTopology topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_FAN;
+  bool blend = false; // alpha blended in draw order, depth neither tested nor written
+};
+
+
+// compute pipelines over storage buffers, for passes built outside the cone
+// render pass; every shader shares one layout of `bindings` storage buffers
+// and push constants, and each set binds its own buffers
+struct ComputePipeline {
+  VkDescriptorSetLayout setLayout = VK_NULL_HANDLE;
+  VkPipelineLayout layout;
+  VkDescriptorPool pool;
+  std::vector<VkDescriptorSet> sets;
+  std::vector<VkPipeline> pipelines; // in the order the shaders were given
+};
+
+
+class HeadlessVulkan;
+
+// work on the queue that the host has not waited for yet. Wait blocks until
+// the fence signals, Ready polls it; a handle dropped without waiting waits
+// as it goes, so the command buffers it used are never recorded again while
+// pending. Handles must not outlive the HeadlessVulkan that made them
+class DeviceSubmission {
+  protected:
+    HeadlessVulkan* owner = nullptr;
+    VkFence fence = VK_NULL_HANDLE;
+    uint64_t serial = 0; // submissions on the same fence, in order
+
+  public:
+    DeviceSubmission() {}
+    DeviceSubmission(HeadlessVulkan* owner, VkFence fence, uint64_t serial);
+    DeviceSubmission(DeviceSubmission&& other) noexcept;
+    DeviceSubmission& operator=(DeviceSubmission&& other) noexcept;
+    DeviceSubmission(const DeviceSubmission&) = delete;
+    DeviceSubmission& operator=(const DeviceSubmission&) = delete;
+    ~DeviceSubmission() { Wait(); }
+
+    bool Ready() const;
+    void Wait();
+};
+
+
+// a submission whose result is read on the host once it has completed; the
+// result is only valid until the next submission that writes the same memory
+template <typename T>
+class DeviceFuture : public DeviceSubmission {
+  private:
+    std::function<T()> result;
+
+  public:
+    DeviceFuture() {}
+    DeviceFuture(DeviceSubmission&& submission, std::function<T()> _result)
+      : DeviceSubmission(std::move(submission)), result(std::move(_result)) {}
+
+    T Get() {
+      Wait();
+      return result();
+    }
+};
 
 
 class HeadlessVulkan {
 
   private:
-    VkFormat colorFormat = VK_FORMAT_R8G8B8A8_UNORM;
+    VkFormat colorFormat = VK_FORMAT_R32_UINT; // stipple index labels
+    uint32_t bytesPerPixel = 4;
     VkFormat depthFormat = VK_FORMAT_D32_SFLOAT; // TODO: is this right?
 
-    VkInstance instance;
+    // shared with every other instance, the handles below are copied from it
+    std::shared_ptr<VulkanContext> context;
     VkPhysicalDevice physicalDevice;
     VkDevice device;
     uint32_t queueFamilyIndex;
+    uint32_t queueIndex; // the context's queue this instance submits to
+    bool queueHeld = false; // counted against the queue's load
     VkPipelineCache pipelineCache;
-    VkQueue queue;
     VkCommandPool commandPool;
-    VkCommandBuffer commandBuffer;
-    VkDescriptorSetLayout descriptorSetLayout;
-    VkPipelineLayout pipelineLayout;
-    VkPipeline pipeline;
+    VkFence renderFence;
+
+    // the latest submission on each fence, completed by its handle's Wait or
+    // by the next submission that needs the fence, whichever comes first
+    struct FenceState {
+      uint64_t serial = 0;
+      bool pending = false;
+      std::vector<VkCommandBuffer> cmdBuffers;
+    };
+    std::map<VkFence, FenceState> fenceStates;
+    friend class DeviceSubmission;
+
+    std::vector<VkCommandBuffer> commandBuffers;
+    std::vector<VkFence> fences;
+    uint32_t nextCommandBuffer = 0;
+    uint32_t pendingCommandBuffer; // slot handed out by BeginCommands
+    VkDescriptorSetLayout descriptorSetLayout = VK_NULL_HANDLE;
+    VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+    VkPipeline pipeline = VK_NULL_HANDLE;
     std::vector<VkShaderModule> shaderModules;
-    VkBuffer vertexBuffer, indexBuffer;
-    VkDeviceMemory vertexMemory, indexMemory;
-    VkDebugReportCallbackEXT debugReportCallback{};
-
-    struct FrameBufferAttachment {
-      VkImage image;
-      VkDeviceMemory memory;
-      VkImageView view;
+
+    // counts are patched through indirect draws so the render command only
+    // needs recording again when the batches' vertex buffers change
+    DeviceBuffer indirectBuffer;
+    VkDrawIndirectCommand* indirectCommands;
+    std::vector<DrawBatch> recordedBatches;
+
+    // a horizontal strip of a tile's readback with its own copy and fence,
+    // so the host can start on it while the strips below are in flight
+    struct ReadbackBand {
+      LabelRegion region; // in the image
+      VkCommandBuffer copy; // pre-recorded
+      VkFence fence;
     };
 
+    // a region of the image rendered into the shared framebuffer; every tile
+    // draws all batches with the projection shifted onto it, so labels are
+    // exact across tile edges
+    struct RenderTile {
+      int32_t x, y; // origin in the image
+      uint32_t width, height; // clipped to the image
+      VkCommandBuffer render; // pre-recorded cone pass
+      VkCommandBuffer readback; // pre-recorded copy of the whole tile into readbackBuffer
+      VkCommandBuffer moments; // pre-recorded reduction
+      std::vector<ReadbackBand> bands; // the same copy, top to bottom
+    };
+
+    std::vector<RenderTile> tiles;
+    VkClearColorValue clearColor;
+    uint32_t tileWidth, tileHeight; // framebuffer extent
+
     int32_t width, height;
+    uint32_t layers = 1; // independent images in the framebuffer's array layers
 
-    VkFramebuffer framebuffer;
-    FrameBufferAttachment colorAttachment, depthAttachment;
-    VkRenderPass renderPass;
+    VkFramebuffer framebuffer = VK_NULL_HANDLE;
+    DeviceImage colorAttachment, depthAttachment;
 
-    void CreateInstance();
+    // tightly packed, host visible copy of the colour attachment that stays
+    // mapped; a buffer rather than a linear image since linear tiling of the
+    // integer label formats is not guaranteed. It holds one tile and is only
+    // made once labels are first read; a tiled image is gathered tile by tile
+    // into tiledLabels, ordinary host memory
+    DeviceBuffer readbackBuffer;
+    const unsigned char* readbackData = nullptr;
+    std::vector<unsigned char> tiledLabels;
+
+    // moment reduction, a compute pass that samples the label attachment and
+    // accumulates into a device local buffer with float atomics; only the
+    // moments are copied back
+    bool floatAtomics = false;
+    VkSampler labelSampler = VK_NULL_HANDLE;
+    VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+    VkDescriptorSetLayout momentSetLayout;
+    VkDescriptorSet momentSet;
+    VkPipelineLayout momentPipelineLayout;
+    VkPipeline momentPipeline;
+    DeviceBuffer densityBuffer; // one tile of density
+    std::vector<float> tiledDensity; // the whole image, tiled only
+    DeviceBuffer densityStaging[2]; // one tile each, alternating, tiled only
+    float* densityStagingData[2];
+    VkFence densityFences[2] = { VK_NULL_HANDLE, VK_NULL_HANDLE };
+    DeviceBuffer momentBuffer, momentReadbackBuffer;
+    uint32_t momentCapacity = 0; // cells
+    const float* momentData;
+    VkCommandBuffer momentClearCommand; // pre-recorded, ahead of the first tile
+    VkCommandBuffer momentCopyCommand; // pre-recorded copy of the moments to the host
+    VkRenderPass renderPass = VK_NULL_HANDLE;
+
+    // a pair of timestamps per command buffer, written at its start and end;
+    // completed submissions add their span to the pass they were recorded
+    // for, until TakeTimings hands the totals out
+    struct TimedCommand {
+      uint32_t query;
+      double DeviceTimings::* pass = nullptr;
+    };
+    VkQueryPool queryPool = VK_NULL_HANDLE;
+    std::map<VkCommandBuffer, TimedCommand> timedCommands;
+    double timestampPeriod; // nanoseconds per tick
+    uint64_t timestampMask; // valid bits of a timestamp
+    DeviceTimings timings;
+
+    void AttachContext();
+    static uint32_t FormatSize(VkFormat format);
     uint32_t GetMemoryTypeIndex(uint32_t typeBits, VkMemoryPropertyFlags properties);
+    bool FindMemoryType(uint32_t typeBits, VkMemoryPropertyFlags properties, uint32_t* index);
+    void CreateTiles();
+    std::vector<VkCommandBuffer> GetTileCommands(VkCommandBuffer RenderTile::* after);
+    DeviceImage CreateImage(const VkImageCreateInfo& imageInfo, VkImageAspectFlags aspect);
     void CreateFrameBuffer();
     void CreateRenderPass();
-    void CreatePipeline(VkPipelineVertexInputStateCreateInfo& vertexInputState);
-    VkShaderModule LoadShader(std::string shaderPath);
+    void CreatePipeline(VkPipelineVertexInputStateCreateInfo& vertexInputState, const PipelineShaders& shaders);
+    VkShaderModule LoadShader(std::string name);
     void CreateCommandPool();
-    void CreateQueue();
-    void CreateDevice();
-    void SubmitWork(VkCommandBuffer cmdBuffer, VkQueue queue);
+    void CreateCommandBuffers();
+    void CreateQueryPool();
+    void BeginTimestamp(VkCommandBuffer cmdBuffer, double DeviceTimings::* pass);
+    void EndTimestamp(VkCommandBuffer cmdBuffer);
+    void CollectTimestamps(const std::vector<VkCommandBuffer>& cmdBuffers);
+    uint32_t AcquireCommandBuffer(double DeviceTimings::* pass);
+    void UpdateRenderCommand(const std::vector<DrawBatch>& batches);
+    void CreateReadbackBuffer();
+    void RecordCopyImage();
+    void RecordRegionCopy(VkCommandBuffer cmdBuffer, const RenderTile& tile, const LabelRegion& region);
+    void GatherRegion(const RenderTile& tile, const LabelRegion& region);
+    void ReadTiles();
+    LabelMap GetReadbackView(uint32_t layer = 0);
+    cimg_library::CImg<uint32_t> ToCImg(const LabelMap& view);
+    void CreateMomentPipeline();
+    void CreateMomentBuffer(uint32_t cells);
+    void RecordMoments();
+    DeviceSubmission SubmitMoments(VkCommandBuffer last);
+    DeviceSubmission SubmitWorkAsync(const std::vector<VkCommandBuffer>& cmdBuffers, VkFence fence);
+    void SubmitWork(const std::vector<VkCommandBuffer>& cmdBuffers, VkFence fence);
+    bool IsComplete(VkFence fence, uint64_t serial);
+    void CompleteWork(VkFence fence, uint64_t serial);
+    void CompleteWork(VkFence fence);
     void Cleanup();  
 
   public:
-    VkResult CreateBuffer(VkBufferUsageFlags usageFlags, VkMemoryPropertyFlags memoryPropertyFlags, VkBuffer *buffer, VkDeviceMemory *memory, VkDeviceSize size, void *data = nullptr);
-    cimg_library::CImg<unsigned char> CopyImage();
-    void RenderImage(std::vector<VkBuffer> buffers, uint32_t vertexCount, uint32_t instanceCount);
-    void CopyData(void* data, uint32_t bufferSize, VkBuffer& ouputBuffer, VkDeviceMemory* outputMemory);
+    DeviceBuffer CreateBuffer(VkBufferUsageFlags usageFlags, VkMemoryPropertyFlags memoryPropertyFlags, VkDeviceSize size, const void* data = nullptr);
+    cimg_library::CImg<uint32_t> CopyImage();
+    void RenderImage(const std::vector<DrawBatch>& batches);
+    cimg_library::CImg<uint32_t> RenderAndCopyImage(const std::vector<DrawBatch>& batches);
+    LabelMap MapImage();
+    LabelMap RenderAndMapImage(const std::vector<DrawBatch>& batches);
+    LabelMap RenderAndStreamImage(const std::vector<DrawBatch>& batches, const LabelBandCallback& band);
+
+    // one submission and one readback for every layer, a view of each in order
+    std::vector<LabelMap> RenderAndMapLayers(const std::vector<DrawBatch>& batches);
+    uint32_t Layers() const { return layers; }
+
+    // as above, returning as soon as the work is queued; the host is free
+    // until it needs the result
+    DeviceSubmission RenderImageAsync(const std::vector<DrawBatch>& batches);
+    DeviceFuture<LabelMap> RenderAndMapImageAsync(const std::vector<DrawBatch>& batches);
+    DeviceFuture<const float*> RenderAndReduceMomentsAsync(const std::vector<DrawBatch>& batches, uint32_t cells);
+
+    bool SupportsMoments() const { return floatAtomics && layers == 1; }
+    void SetClearColor(const VkClearColorValue& color);
+    void SetDensity(const std::vector<float>& density);
+    void ReserveMoments(uint32_t cells);
+    const float* RenderAndReduceMoments(const std::vector<DrawBatch>& batches, uint32_t cells);
+    void RenderAndReduceMoments(const std::vector<DrawBatch>& batches, VkCommandBuffer next);
+    VkBuffer GetMomentBuffer() const { return momentBuffer; }
+    VkBuffer GetIndirectBuffer() const { return indirectBuffer; }
+    VkCommandBuffer AllocateCommandBuffer();
+    void FreeCommandBuffer(VkCommandBuffer cmdBuffer);
+    void CopyData(const void* data, VkDeviceSize bufferSize, VkBuffer outputBuffer);
+    DeviceBuffer CreateHostBuffer(VkBufferUsageFlags usageFlags, VkDeviceSize size);
+    void InvalidateHostBuffer(const DeviceBuffer& buffer);
+
+    ComputePipeline CreateComputePipeline(const std::vector<std::string>& shaders, uint32_t bindings, uint32_t sets, uint32_t pushConstantSize);
+    void UpdateComputeSet(ComputePipeline& compute, uint32_t set, const std::vector<VkBuffer>& buffers);
+    void DestroyComputePipeline(ComputePipeline& compute);
+    VkCommandBuffer BeginCommands();
+    void SubmitCommands();
+    DeviceSubmission SubmitCommandsAsync();
+
+    // waits for every submission still in flight; callers replace or rewrite
+    // host visible buffers only after this, as an async submission may be
+    // reading them
+    void CompletePending();
+    DeviceTimings TakeTimings();
+
+    // a pooled instance gives up its queue while idle, so it does not count
+    // against the queue's load, and takes the least loaded queue of its
+    // device when reused
+    void ReleaseQueue();
+    void AcquireQueue();
+    uint32_t QueueLoad() { return context->LeastActive(); }
+    uint32_t DeviceOrdinal() const { return context->Ordinal(); }
+    uint32_t QueueIndex() const { return queueIndex; }
+
     HeadlessVulkan() {}
 
+    // device, queue and command buffers only, for engines that bring their
+    // own compute passes
+    HeadlessVulkan(int _width, int _height) {
+      width = _width;
+      height = _height;
+
+      AttachContext();
+      CreateCommandPool();
+      CreateCommandBuffers();
+      CreateQueryPool();
+    }
+
+    // with more than one layer the vertex shader picks each primitive's
+    // layer, and every layer is its own image of the same size
     HeadlessVulkan(int _width, int _height, VkPipelineVertexInputStateCreateInfo&
-        vertexInputState) {
+        vertexInputState, VkFormat _colorFormat = VK_FORMAT_R32_UINT,
+        const PipelineShaders& shaders = PipelineShaders(), uint32_t _layers = 1) {
       width = _width;
       height = _height;
+      colorFormat = _colorFormat;
+      bytesPerPixel = FormatSize(colorFormat);
+      layers = _layers;
+
+      // uncovered pixels keep an all ones label, no stipple can reach it
+      for (uint32_t& channel : clearColor.uint32) {
+        channel = LABEL_EMPTY;
+      }
 
       // TODO: pass in vertex attachments to pipelines
       
-      CreateInstance();
-      CreateDevice();
-      CreateQueue();
+      AttachContext();
       CreateCommandPool();
+      CreateCommandBuffers();
+      CreateTiles();
+      CreateQueryPool();
       CreateFrameBuffer();
       CreateRenderPass();
-      CreatePipeline(vertexInputState); 
+      CreatePipeline(vertexInputState, shaders); 
     }
 
     VkDevice GetDevice() {
@@ -0,0 +1,54 @@
+#ifndef JFA_VORONOI_H
+#define JFA_VORONOI_H
+
+#include "voronoi.h"
+#include "voronoiEngine.h"
+#include "utils.h"
+#include "headlessVulkan.h"
+
+#define cimg_use_jpeg
+#include "CImg.h"
+#include <vector>
+#include "glm/glm.hpp"
+#include "glm/vec2.hpp"
+
+#define JFA_GROUP_SIZE 8 // matches local_size_x and _y of the jump flood shaders
+#define JFA_SEED_GROUP_SIZE 64 // matches local_size_x of jfaSeed.comp
+
+// Voronoi labels by jump flooding: sites are seeded into a label buffer and
+// propagated in log2(max(width, height)) passes of halving step, so the cost
+// depends on the image size rather than the number of points
+class JFAVoronoi : public VoronoiEngine {
+  private:
+    HeadlessVulkan* computePipeline;
+    ComputePipeline jumpFlood; // seed and step shaders, ping-pong sets
+
+    // ping-pong label buffers, one uint per pixel
+    DeviceBuffer labelBuffers[2];
+
+    // site positions, host visible and mapped, grown like the cone instances
+    DeviceBuffer siteBuffer;
+    glm::vec2* sites = nullptr;
+    uint32_t siteBufferSize = 0;
+
+    DeviceBuffer readbackBuffer;
+    const unsigned char* readbackData;
+
+    int width, height;
+
+    void GenerateSiteBuffer(uint32_t len);
+    void BindSets();
+    uint32_t Flood(uint32_t count);
+
+  public:
+    using VoronoiEngine::GetLabelMap;
+
+    cimg_library::CImg<uint32_t> GetImage(const std::vector<glm::vec2>& points) override;
+    LabelMap GetLabelMap(const std::vector<glm::vec2>& points) override;
+    DeviceTimings TakeTimings() override { return computePipeline->TakeTimings(); }
+
+    JFAVoronoi(int _width, int _height);
+    ~JFAVoronoi() override;
+};
+
+#endif
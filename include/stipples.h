@@ -7,7 +7,9 @@
 #include "CImg.h"
 #include "voronoi.h"
 #include "utils.h"
-#include "gpuVoronoi.h"
+#include "voronoiEngine.h"
+#include "engineRegistry.h"
+#include "discRenderer.h"
 #include "glm/glm.hpp"
 #include "glm/vec3.hpp"
 #include "glm/vec2.hpp"
@@ -15,6 +17,9 @@
 
 using namespace cimg_library;
 
+#define CONE_RADIUS_MARGIN 2.0f // cones reach this far past the expected cell radius
+#define DENSITY_MAP_SCALE 16 // pixels per density map sample
+
 struct Params {
     int count;
     float jitter;
@@ -25,6 +30,9 @@ struct Params {
     int maxPoints;
     glm::vec3 bgdColor;
     float multiplier;
+    EngineType engine = EngineType::Auto;
+    VoronoiMode mode = VoronoiMode::Cones; // raster engine only
+    bool resident = false; // iterate on the device when the engine can
 
     Params(int _count, float _jitter, float _hStep, float _hConst, float _pointSize, int _maxIters, int _maxPts, glm::vec3 _bgdColor, int _multiplier ) : count(_count), jitter(_jitter), hStep(_hStep), hConst(_hConst), pointSize(_pointSize), maxIterations(_maxIters), maxPoints(_maxPts), bgdColor(_bgdColor), multiplier(_multiplier) {}
 };
@@ -65,6 +73,7 @@ public:
     bool IsError();
 
     CImg<unsigned char> DrawImage();
+    CImg<unsigned char> RenderImage(int width, int height);
 
     std::vector<Point>* GetPoints();
 
@@ -74,8 +83,10 @@ private:
     int changes = -1; // track splits and merges
     int iterations = 0;
     std::vector<Point> stipples;
+    std::vector<float> cellAreas; // previous area of each stipple's cell, in pixels
+    CImg<unsigned char> densityMap; // coarse mean intensity, for sizing cones
 
-    GPUVoronoi* voronoiSolver;
+    VoronoiEngine* voronoiSolver;
 
     glm::vec2 Jitter(glm::vec2 pt);
     inline float GetHysteresis() {return this->params.hConst
@@ -90,7 +101,11 @@ private:
         return (1.0f - hysteresis / 2.0f) * PI * pointSize * pointSize * this->params.multiplier;
     }
 
+    bool SolveResident();
     std::vector<Point> GetRandomStipples(const int& count);
+    std::vector<float> GetConeRadii(float hysteresis);
+    float GetConeRadius(glm::vec2 pos, float bound, float area);
+    const EngineEntry& AutoselectEngine();
     glm::vec2 GetSplitAxis(const VoronoiCell& vc);
 
 
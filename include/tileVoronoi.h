@@ -0,0 +1,68 @@
+#ifndef TILE_VORONOI_H
+#define TILE_VORONOI_H
+
+#include "voronoi.h"
+#include "voronoiEngine.h"
+#include "utils.h"
+#include "workerPool.h"
+
+#include "CImg.h"
+#include <vector>
+#include "glm/glm.hpp"
+#include "glm/vec2.hpp"
+
+#define TILE_SIZE 16 // pixels a side of a tile, one AVX-512 or two AVX2 vectors a row
+#define TILE_SITES_PER_BIN 2 // average sites in a bin of the site grid
+
+// candidate sites of one tile, offset to the tile's corner and in index order
+struct TileCandidates {
+  std::vector<float> x, y;
+  std::vector<uint32_t> labels;
+};
+
+// brute force nearest site per pixel, made cheap by culling: sites are
+// counting sorted into a uniform grid, and each tile of pixels gathers only
+// the sites within reach of it, which at LBG densities is a few dozen. The
+// distances of a tile row are then taken for 8 or 16 pixels at once, with
+// AVX-512 or AVX2 when the host has them and a scalar loop otherwise, all
+// giving the same labels. Tiles are shared out to the worker pool
+class TileVoronoi : public VoronoiEngine {
+  public:
+    typedef void (*TileKernel)(const TileCandidates& candidates, uint32_t* tile);
+
+  private:
+    WorkerPool workers;
+    int width, height;
+    uint32_t tilesX, tilesY;
+    TileKernel kernel;
+
+    // sites in pixels, counting sorted into square bins
+    std::vector<glm::vec2> sites;
+    int binsX, binsY;
+    float binSize;
+    std::vector<uint32_t> binStarts; // binsX * binsY + 1 offsets into binSites
+    std::vector<uint32_t> binSites;
+
+    std::vector<uint32_t> labels;
+
+    void BuildGrid(const std::vector<glm::vec2>& points);
+    void GatherCandidates(uint32_t tile, TileCandidates& candidates);
+    void ShadeTile(uint32_t tile, TileCandidates& candidates);
+
+  public:
+    using VoronoiEngine::GetLabelMap;
+
+    cimg_library::CImg<uint32_t> GetImage(const std::vector<glm::vec2>& points) override;
+    LabelMap GetLabelMap(const std::vector<glm::vec2>& points) override;
+
+    // "avx512", "avx2" or "scalar", whichever the host was found to run
+    const char* KernelName() const;
+
+    // forces one of the kernels above by name, false if the host cannot run it
+    bool SetKernel(const char* name);
+
+    // zero threads takes one per hardware thread
+    TileVoronoi(int _width, int _height, uint32_t threads = 0);
+};
+
+#endif
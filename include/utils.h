@@ -4,6 +4,8 @@
 #define PI 3.1415926536
 
 #include <vector>
+#include <cstdint>
+#include <functional>
 #include "glm/glm.hpp"
 #include "glm/vec3.hpp"
 #include <iostream>
@@ -22,32 +24,58 @@ inline std::vector<int> range(int limit) {
   return V;
 }
 
-inline glm::vec3 EncodeColor(uint32_t i) {
-  uint8_t r = (i >> 16) & 0x000000ff;
-  uint8_t g = (i >> 8) & 0x000000ff;
-  uint8_t b = (i >> 0) & 0x000000ff;
+// pixels not covered by any cell, all bits set in the label's width
+#define LABEL_EMPTY 0xffffffff
 
-#ifdef DEBUG
-  if(i == 0) {
-    return {1, 0, 0};
-  }
-  if(i == 1) {
-    return {0, 1, 0};
+// read-only view over a mapped label image; rows are rowPitch bytes apart
+// and the view is only valid until the next render into the same target.
+// labels are stipple indices, 16 or 32 bits wide
+struct LabelMap {
+  const unsigned char* data = nullptr;
+  size_t rowPitch = 0;
+  int width = 0;
+  int height = 0;
+  uint32_t bytesPerLabel = 4;
+
+  inline const unsigned char* Row(int y) const {
+    return data + y * rowPitch;
   }
-  if(i == 2) {
-    return {0, 0, 1};
+
+  inline uint32_t At(int x, int y) const {
+    if (bytesPerLabel == 2) {
+      uint16_t label = reinterpret_cast<const uint16_t*>(Row(y))[x];
+      return label == 0xffff ? LABEL_EMPTY : label;
+    }
+    return reinterpret_cast<const uint32_t*>(Row(y))[x];
   }
-#endif
+};
 
-  return {r / 255.0f, g / 255.0f, b / 255.0f};
-}
+// a rectangle of a label map in pixels, for work done on part of it
+struct LabelRegion {
+  int x = 0;
+  int y = 0;
+  int width = 0;
+  int height = 0;
+};
 
-inline uint32_t DecodeColor(unsigned char r, unsigned char g, unsigned char b) {
-  uint32_t result = 0x00000000 | (static_cast<uint32_t>(r) << 16) | (static_cast<uint32_t>(g) << 8) | (static_cast<uint32_t>(b));
-  // std::cout << "decoded" << std::endl;
-  // std::cout << std::hex << result  << " " << (int)r << " " << (int)g << " " << (int)b << std::endl;
-  return result;
-}
+// called for each region of a label map as soon as its labels are readable
+typedef std::function<void(const LabelMap&, const LabelRegion&)> LabelBandCallback;
+
+// milliseconds spent on the device by each kind of pass, from timestamps
+// written around their command buffers, and on the host waiting for them;
+// device times stay zero where the queue has no timestamp support
+struct DeviceTimings {
+  double render = 0.0;   // cone rasterization, every tile
+  double readback = 0.0; // label image copies to the host
+  double moments = 0.0;  // moment reduction and its copy to the host
+  double upload = 0.0;   // CopyData transfers
+  double compute = 0.0;  // passes recorded through BeginCommands
+  double wait = 0.0;     // host blocked on fences
+
+  bool Timed() const {
+    return render + readback + moments + upload + compute > 0.0;
+  }
+};
 
 
 #endif
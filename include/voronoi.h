@@ -2,6 +2,8 @@
 #define VORONOI_H
 
 #include <vector>
+#include <limits>
+#include <algorithm>
 #define cimg_use_jpeg
 #include "CImg.h"
 #include "utils.h"
@@ -23,6 +25,16 @@ struct VoronoiCell {
   float m02 = 0;
 };
 
-std::vector<VoronoiCell> GetVoronoiCells(const CImg<unsigned char>& map, const CImg<unsigned char>& img, std::vector<glm::vec2> pts);
+// stipple density of a pixel, darker pixels attract more stipples
+inline float Density(unsigned char intensity) {
+  return std::max(1.0f - intensity / 255.0f, std::numeric_limits<float>::epsilon());
+}
+
+std::vector<VoronoiCell> GetVoronoiCells(const CImg<uint32_t>& map, const CImg<unsigned char>& img, const std::vector<glm::vec2>& pts);
+void FinalizeVoronoiCells(std::vector<VoronoiCell>& voronoi, int width, int height);
+std::vector<VoronoiCell> GetVoronoiCells(const LabelMap& map, const CImg<unsigned char>& img, const std::vector<glm::vec2>& pts);
+// adds one region's pixels to the moments, cells are finalized once every
+// region has been accumulated
+void AccumulateVoronoiCells(std::vector<VoronoiCell>& voronoi, const LabelMap& map, const CImg<unsigned char>& img, const LabelRegion& region);
 
 #endif
@@ -0,0 +1,85 @@
+#ifndef VORONOI_ENGINE_H
+#define VORONOI_ENGINE_H
+
+#include <vector>
+#include <stdexcept>
+#include "voronoi.h"
+#include "utils.h"
+#include "CImg.h"
+#include "glm/glm.hpp"
+
+// which engine builds the label map each iteration
+enum class EngineType {
+  Auto, // whichever available engine is fastest here, see SelectEngine
+  Raster,   // instanced cones or quads, GPUVoronoi
+  JumpFlood, // jump flooding compute passes, JFAVoronoi
+  CpuJumpFlood, // jump flooding on host threads, CPUJFAVoronoi
+  Exact, // clipped cell polygons with moments from prefix sums, ExactVoronoi
+  DistanceTransform, // separable Euclidean distance transform of pixel snapped seeds on host threads, EDTVoronoi
+  Tiled // culled brute force over tiles with vector kernels, TileVoronoi
+};
+
+// hysteresis bounds on a cell's mass for one device resident iteration
+struct ResidentBounds {
+  float lower;
+  float upper;
+  float jitter;
+  float margin; // cones reach this far past a cell's expected radius
+};
+
+// common contract of the Voronoi engines; points are in [0, 1] image space
+// and labels are indices into points, LABEL_EMPTY where nothing reached
+class VoronoiEngine {
+  public:
+    virtual ~VoronoiEngine() {}
+
+    virtual cimg_library::CImg<uint32_t> GetImage(const std::vector<glm::vec2>& points) = 0;
+
+    // view into the engine's label storage, valid until the next call
+    virtual LabelMap GetLabelMap(const std::vector<glm::vec2>& points) = 0;
+
+    // radii bound each site's reach in pixels, engines that cannot make use
+    // of them ignore them
+    virtual LabelMap GetLabelMap(const std::vector<glm::vec2>& points, const std::vector<float>& radii) {
+      return GetLabelMap(points);
+    }
+
+    // the same map a band at a time, `band` sees each region as soon as it
+    // is readable and every pixel exactly once; engines without a banded
+    // readback hand over the whole map as one band
+    virtual LabelMap StreamLabelMap(const std::vector<glm::vec2>& points, const std::vector<float>& radii, const LabelBandCallback& band) {
+      LabelMap map = GetLabelMap(points, radii);
+
+      LabelRegion region;
+      region.width = map.width;
+      region.height = map.height;
+      band(map, region);
+      return map;
+    }
+
+    // engines that reduce moments themselves skip the label map entirely
+    virtual bool SupportsMoments() const { return false; }
+    virtual void SetDensity(const cimg_library::CImg<unsigned char>& img) {}
+    virtual std::vector<VoronoiCell> GetCells(const std::vector<glm::vec2>& points, const std::vector<float>& radii) {
+      throw std::runtime_error("engine does not reduce moments!");
+    }
+
+    // device resident iterations: the points never leave the device, only
+    // their count and the number of changes come back until ReadPoints
+    virtual bool SupportsResident() const { return false; }
+    virtual void BeginResident(const std::vector<glm::vec2>& points, uint32_t capacity) {
+      throw std::runtime_error("engine does not iterate on the device!");
+    }
+    virtual void IterateResident(const ResidentBounds& bounds, uint32_t* count, uint32_t* changes) {
+      throw std::runtime_error("engine does not iterate on the device!");
+    }
+    virtual std::vector<glm::vec2> ReadPoints() {
+      throw std::runtime_error("engine does not iterate on the device!");
+    }
+
+    // time spent on the device since the previous call, all zero for
+    // engines that do not time their passes
+    virtual DeviceTimings TakeTimings() { return DeviceTimings(); }
+};
+
+#endif
@@ -0,0 +1,146 @@
+#ifndef VULKAN_CONTEXT_H
+#define VULKAN_CONTEXT_H
+
+#include "vulkanLoader.h"
+#include <cassert>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "deviceMemory.h"
+
+// pipeline cache data is kept per device and driver under the directory
+// PIPELINE_CACHE_ENV names, else under PIPELINE_CACHE_APP in $XDG_CACHE_HOME
+// or ~/.cache; the working directory's PIPELINE_CACHE_PATH is the last resort
+#define PIPELINE_CACHE_ENV "LBG_CACHE_PATH"
+#define PIPELINE_CACHE_APP "lbg-stippling"
+#define PIPELINE_CACHE_PATH "resources/cache/"
+
+#define VK_CHECK_RESULT(f) \
+{\
+  VkResult res = (f);\
+  if (res != VK_SUCCESS) \
+  {\
+    std::cout << "Fatal : Error in " << __FILE__ << " at line " << __LINE__ << " with code " << res << std::endl;\
+    assert(res == VK_SUCCESS);\
+  }\
+}
+
+#define LOG(...) printf(__VA_ARGS__)
+
+static VKAPI_ATTR VkBool32 VKAPI_CALL debugMessageCallback(
+    VkDebugReportFlagsEXT flags,
+    VkDebugReportObjectTypeEXT objectType,
+    uint64_t object,
+    size_t location,
+    int32_t messageCode,
+    const char* pLayerPrefix,
+    const char* pMessage,
+    void* pUserData)
+{
+  LOG("[VALIDATION]: %s - %s\n", pLayerPrefix, pMessage);
+  return VK_FALSE;
+}
+
+
+// which physical devices solvers run on and how widely they are spread;
+// several logical devices on one physical device are allowed, so sharding
+// can be exercised on a single GPU or a software rasteriser
+struct DevicePolicy {
+  int index = -1; // in enumeration order, -1 for any
+  std::string name; // part of the device name, empty for any
+  std::optional<VkPhysicalDeviceType> type; // otherwise discrete GPUs first
+  uint32_t devices = 1; // logical devices, matching physical devices taken in turn
+  uint32_t queues = 1; // per logical device, bounded by the queue family
+  bool report = false; // throughput of every queue at exit
+
+  // comma separated: discrete, integrated, virtual, cpu, index=N, name=S,
+  // devices=N, queues=N, report
+  static DevicePolicy Parse(const std::string& spec);
+};
+
+
+// one queue of a logical device and the solvers submitting to it
+struct DeviceQueue {
+  VkQueue queue;
+  std::mutex mutex; // queues are externally synchronised
+  std::atomic<uint32_t> active{0}; // solvers attached now
+  uint64_t jobs = 0; // solvers attached so far
+  uint64_t submissions = 0;
+  double busy = 0.0; // milliseconds of timed device work
+};
+
+
+// the one instance behind every logical device of the policy, so the entry
+// points resolved through it serve them all; destroyed with the last of them
+struct SharedInstance {
+  VkInstance instance = VK_NULL_HANDLE;
+  VkDebugReportCallbackEXT debugReportCallback = VK_NULL_HANDLE;
+
+  SharedInstance() {}
+  SharedInstance(const SharedInstance&) = delete;
+  SharedInstance& operator=(const SharedInstance&) = delete;
+  ~SharedInstance();
+};
+
+
+// instance, device, queues and pipeline cache shared by HeadlessVulkan
+// instances, so only the first solver on each pays for creating them. The
+// policy may ask for several; each solver is given the least loaded queue
+// of them all and keeps it while attached, a pooled solver gives its queue
+// up and takes the least loaded one of its device again when reused
+class VulkanContext {
+  private:
+    std::shared_ptr<SharedInstance> sharedInstance;
+    std::string pipelineCacheDir;
+    std::string pipelineCacheFile;
+    uint32_t ordinal; // position among the policy's logical devices
+    std::chrono::steady_clock::time_point created;
+
+    VulkanContext(const DevicePolicy& policy, uint32_t ordinal, std::shared_ptr<SharedInstance> sharedInstance);
+    static std::shared_ptr<SharedInstance> CreateInstance();
+    void CreateDevice(const DevicePolicy& policy);
+    static std::string GetPipelineCacheDir();
+    void CreatePipelineCache();
+    void SavePipelineCache();
+    void ReportThroughput();
+
+  public:
+    VkInstance instance;
+    VkPhysicalDevice physicalDevice;
+    VkDevice device;
+    uint32_t queueFamilyIndex;
+    std::deque<DeviceQueue> queues;
+    bool report = false;
+    VkPipelineCache pipelineCache;
+    bool floatAtomics = false; // VK_EXT_shader_atomic_float is enabled
+    bool layerOutput = false; // VK_EXT_shader_viewport_index_layer is enabled
+    MemoryAllocator allocator;
+
+    // the policy is fixed once the first solver has acquired a queue
+    static void SetPolicy(const DevicePolicy& policy);
+    static std::shared_ptr<VulkanContext> Acquire(uint32_t* queueIndex);
+    void AcquireQueue(uint32_t* queueIndex);
+    void Release(uint32_t queueIndex);
+
+    // solvers attached to the least loaded queue, of this device or of all
+    uint32_t LeastActive();
+    static uint32_t LeastActiveOverall();
+    uint32_t Ordinal() const { return ordinal; }
+
+    void Submit(const VkSubmitInfo& submitInfo, VkFence fence, uint32_t queueIndex);
+    void AddDeviceTime(uint32_t queueIndex, double milliseconds);
+
+    VulkanContext(const VulkanContext&) = delete;
+    VulkanContext& operator=(const VulkanContext&) = delete;
+    ~VulkanContext();
+};
+
+#endif
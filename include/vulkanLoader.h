@@ -0,0 +1,128 @@
+#ifndef VULKAN_LOADER_H
+#define VULKAN_LOADER_H
+
+// the Vulkan loader is opened at run time rather than linked, so the same
+// binary starts on machines without one and falls back to the host engines;
+// every translation unit reaches vulkan.h through here
+#define VK_NO_PROTOTYPES
+#include <vulkan/vulkan.h>
+
+// entry points callable before an instance exists
+#define VULKAN_GLOBAL_FUNCTIONS(F) \
+  F(vkCreateInstance) \
+  F(vkEnumerateInstanceLayerProperties)
+
+// commands on an instance or physical device, resolved through the instance
+#define VULKAN_INSTANCE_FUNCTIONS(F) \
+  F(vkCreateDevice) \
+  F(vkDestroyInstance) \
+  F(vkEnumerateDeviceExtensionProperties) \
+  F(vkEnumeratePhysicalDevices) \
+  F(vkGetDeviceProcAddr) \
+  F(vkGetPhysicalDeviceFeatures2) \
+  F(vkGetPhysicalDeviceMemoryProperties) \
+  F(vkGetPhysicalDeviceProperties) \
+  F(vkGetPhysicalDeviceQueueFamilyProperties)
+
+// commands on a device or its children; resolved through the instance they
+// serve every device created from it, through vkGetDeviceProcAddr only the
+// one they were fetched for
+#define VULKAN_DEVICE_FUNCTIONS(F) \
+  F(vkAllocateCommandBuffers) \
+  F(vkAllocateDescriptorSets) \
+  F(vkAllocateMemory) \
+  F(vkBeginCommandBuffer) \
+  F(vkBindBufferMemory) \
+  F(vkBindImageMemory) \
+  F(vkCmdBeginRenderPass) \
+  F(vkCmdBindDescriptorSets) \
+  F(vkCmdBindPipeline) \
+  F(vkCmdBindVertexBuffers) \
+  F(vkCmdCopyBuffer) \
+  F(vkCmdCopyImageToBuffer) \
+  F(vkCmdDispatch) \
+  F(vkCmdDrawIndirect) \
+  F(vkCmdEndRenderPass) \
+  F(vkCmdFillBuffer) \
+  F(vkCmdPipelineBarrier) \
+  F(vkCmdPushConstants) \
+  F(vkCmdResetQueryPool) \
+  F(vkCmdSetScissor) \
+  F(vkCmdSetViewport) \
+  F(vkCmdWriteTimestamp) \
+  F(vkCreateBuffer) \
+  F(vkCreateCommandPool) \
+  F(vkCreateComputePipelines) \
+  F(vkCreateDescriptorPool) \
+  F(vkCreateDescriptorSetLayout) \
+  F(vkCreateFence) \
+  F(vkCreateFramebuffer) \
+  F(vkCreateGraphicsPipelines) \
+  F(vkCreateImage) \
+  F(vkCreateImageView) \
+  F(vkCreatePipelineCache) \
+  F(vkCreatePipelineLayout) \
+  F(vkCreateQueryPool) \
+  F(vkCreateRenderPass) \
+  F(vkCreateSampler) \
+  F(vkCreateShaderModule) \
+  F(vkDestroyBuffer) \
+  F(vkDestroyCommandPool) \
+  F(vkDestroyDescriptorPool) \
+  F(vkDestroyDescriptorSetLayout) \
+  F(vkDestroyDevice) \
+  F(vkDestroyFence) \
+  F(vkDestroyFramebuffer) \
+  F(vkDestroyImage) \
+  F(vkDestroyImageView) \
+  F(vkDestroyPipeline) \
+  F(vkDestroyPipelineCache) \
+  F(vkDestroyPipelineLayout) \
+  F(vkDestroyQueryPool) \
+  F(vkDestroyRenderPass) \
+  F(vkDestroySampler) \
+  F(vkDestroyShaderModule) \
+  F(vkEndCommandBuffer) \
+  F(vkFlushMappedMemoryRanges) \
+  F(vkFreeCommandBuffers) \
+  F(vkFreeMemory) \
+  F(vkGetBufferMemoryRequirements) \
+  F(vkGetDeviceQueue) \
+  F(vkGetFenceStatus) \
+  F(vkGetImageMemoryRequirements) \
+  F(vkGetPipelineCacheData) \
+  F(vkGetQueryPoolResults) \
+  F(vkInvalidateMappedMemoryRanges) \
+  F(vkMapMemory) \
+  F(vkQueueSubmit) \
+  F(vkResetCommandBuffer) \
+  F(vkResetFences) \
+  F(vkUpdateDescriptorSets) \
+  F(vkWaitForFences)
+
+#define VULKAN_DECLARE_FUNCTION(name) extern PFN_##name name;
+extern PFN_vkGetInstanceProcAddr vkGetInstanceProcAddr;
+VULKAN_GLOBAL_FUNCTIONS(VULKAN_DECLARE_FUNCTION)
+VULKAN_INSTANCE_FUNCTIONS(VULKAN_DECLARE_FUNCTION)
+VULKAN_DEVICE_FUNCTIONS(VULKAN_DECLARE_FUNCTION)
+#undef VULKAN_DECLARE_FUNCTION
+
+// opens the loader library and resolves the global entry points, false if
+// there is none; safe to call repeatedly
+bool LoadVulkan();
+
+// resolves the instance and device entry points through an instance, which
+// must outlive every call made through them
+void LoadVulkanInstance(VkInstance instance);
+
+// re-resolves the device entry points for the only device that will use
+// them, skipping the instance's dispatch
+void LoadVulkanDevice(VkDevice device);
+
+// a loader is present and reports at least one physical device; probed
+// once with a throwaway instance that leaves the entry points untouched,
+// so a failing driver cannot take down the process later inside
+// VK_CHECK_RESULT
+bool VulkanDeviceAvailable();
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// a fixed set of threads running one parallel loop at a time; the calling
+// thread takes its share of the work, so a pool of one runs inline
+class WorkerPool {
+  private:
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable start, done;
+    const std::function<void(uint32_t)>* body = nullptr;
+    uint32_t count = 0;
+    std::atomic<uint32_t> next{0}; // iterations are handed out one at a time
+    uint32_t busy = 0; // workers still on the current loop
+    uint64_t generation = 0;
+    bool stopping = false;
+
+    void Run();
+    void Work();
+
+  public:
+    // zero threads takes one per hardware thread
+    explicit WorkerPool(uint32_t size = 0);
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    uint32_t Size() const { return static_cast<uint32_t>(threads.size()) + 1; }
+
+    // body(i) for every i in [0, count), returning once all have finished
+    void ParallelFor(uint32_t count, const std::function<void(uint32_t)>& body);
+};
+
+#endif
@@ -0,0 +1,139 @@
+#include "cpuJfaVoronoi.h"
+#include <algorithm>
+#include <cstring>
+
+
+CPUJFAVoronoi::CPUJFAVoronoi(int _width, int _height, uint32_t threads) : workers(threads) {
+  width = _width;
+  height = _height;
+
+  blocksX = (width + CPU_JFA_BLOCK - 1) / CPU_JFA_BLOCK;
+  blocksY = (height + CPU_JFA_BLOCK - 1) / CPU_JFA_BLOCK;
+
+  for(int i = 0; i < 2; i++) {
+    labels[i].resize(static_cast<size_t>(width) * height);
+  }
+}
+
+
+void CPUJFAVoronoi::Seed(uint32_t* destination) {
+  std::fill(destination, destination + static_cast<size_t>(width) * height, LABEL_EMPTY);
+
+  // sites sharing a pixel resolve to the lowest index, as for any tie
+  for(uint32_t i = 0; i < sites.size(); i++) {
+    const int x = std::clamp(static_cast<int>(sites[i].x), 0, width - 1);
+    const int y = std::clamp(static_cast<int>(sites[i].y), 0, height - 1);
+
+    uint32_t& label = destination[static_cast<size_t>(y) * width + x];
+    label = std::min(label, i);
+  }
+}
+
+
+void CPUJFAVoronoi::Step(const uint32_t* source, uint32_t* destination, int step, uint32_t block) {
+  // one block of jfaStep.comp; distances in pixels, from the pixel centre
+  const int x0 = (block % blocksX) * CPU_JFA_BLOCK;
+  const int y0 = (block / blocksX) * CPU_JFA_BLOCK;
+  const int x1 = std::min(x0 + CPU_JFA_BLOCK, width);
+  const int y1 = std::min(y0 + CPU_JFA_BLOCK, height);
+
+  for(int y = y0; y < y1; y++) {
+    const float centreY = y + 0.5f;
+
+    for(int x = x0; x < x1; x++) {
+      const float centreX = x + 0.5f;
+
+      uint32_t best = LABEL_EMPTY;
+      float bestDistance = 0.0f;
+
+      for(int dy = -1; dy <= 1; dy++) {
+        const int neighbourY = y + dy * step;
+        if(neighbourY < 0 || neighbourY >= height) continue;
+        const uint32_t* row = source + static_cast<size_t>(neighbourY) * width;
+
+        for(int dx = -1; dx <= 1; dx++) {
+          const int neighbourX = x + dx * step;
+          if(neighbourX < 0 || neighbourX >= width) continue;
+
+          const uint32_t label = row[neighbourX];
+          if(label == LABEL_EMPTY) continue;
+
+          const float offsetX = sites[label].x - centreX;
+          const float offsetY = sites[label].y - centreY;
+          const float distance = offsetX * offsetX + offsetY * offsetY;
+
+          if(best == LABEL_EMPTY || distance < bestDistance || (distance == bestDistance && label < best)) {
+            best = label;
+            bestDistance = distance;
+          }
+        }
+      }
+
+      destination[static_cast<size_t>(y) * width + x] = best;
+    }
+  }
+}
+
+
+uint32_t CPUJFAVoronoi::Flood() {
+  Seed(labels[0].data());
+
+  // halving steps from half the larger dimension, then a final unit step
+  // which repairs most of the errors jump flooding leaves behind
+  std::vector<int> steps;
+  int step = 1;
+  while(step < std::max(width, height)) {
+    step *= 2;
+  }
+  for(step /= 2; step >= 1; step /= 2) {
+    steps.push_back(step);
+  }
+  steps.push_back(1);
+
+  // every block of a pass reads the whole of the previous one, so passes
+  // are separated by the pool returning
+  uint32_t current = 0;
+  for(int s : steps) {
+    const uint32_t* source = labels[current].data();
+    uint32_t* destination = labels[1 - current].data();
+
+    workers.ParallelFor(blocksX * blocksY, [&](uint32_t block) {
+      Step(source, destination, s, block);
+    });
+
+    current = 1 - current;
+  }
+
+  return current;
+}
+
+
+LabelMap CPUJFAVoronoi::GetLabelMap(const std::vector<glm::vec2>& points) {
+  sites.resize(points.size());
+  for(size_t i = 0; i < points.size(); i++) {
+    sites[i] = points[i] * glm::vec2(width, height);
+  }
+
+  const uint32_t current = Flood();
+
+  // valid until the next call overwrites the buffer
+  LabelMap view;
+  view.data = reinterpret_cast<const unsigned char*>(labels[current].data());
+  view.rowPitch = width * sizeof(uint32_t);
+  view.width = width;
+  view.height = height;
+  view.bytesPerLabel = sizeof(uint32_t);
+  return view;
+}
+
+
+cimg_library::CImg<uint32_t> CPUJFAVoronoi::GetImage(const std::vector<glm::vec2>& points) {
+  LabelMap map = GetLabelMap(points);
+  cimg_library::CImg<uint32_t> out(width, height, 1, 1);
+
+  for(int y = 0; y < height; y++) {
+    memcpy(out.data(0, y), map.Row(y), width * sizeof(uint32_t));
+  }
+
+  return out;
+}
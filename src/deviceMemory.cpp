@@ -0,0 +1,297 @@
+#include "deviceMemory.h"
+#include "vulkanContext.h"
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+
+static VkDeviceSize AlignUp(VkDeviceSize value, VkDeviceSize alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+
+void MemoryAllocator::Init(VkPhysicalDevice physicalDevice, VkDevice _device) {
+  device = _device;
+  vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+
+  VkPhysicalDeviceProperties deviceProperties;
+  vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+  nonCoherentAtomSize = std::max<VkDeviceSize>(deviceProperties.limits.nonCoherentAtomSize, 1);
+
+  for (auto& pool : pools) {
+    pool.resize(memoryProperties.memoryTypeCount);
+  }
+}
+
+
+MemoryBlock* MemoryAllocator::CreateBlock(uint32_t typeIndex, bool linear, VkDeviceSize size, bool dedicated) {
+  VkMemoryAllocateInfo memAlloc = {};
+  memAlloc.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+  memAlloc.allocationSize = size;
+  memAlloc.memoryTypeIndex = typeIndex;
+
+  MemoryBlock block;
+  if (vkAllocateMemory(device, &memAlloc, nullptr, &block.memory) != VK_SUCCESS) {
+    throw std::runtime_error("failed to allocate device memory!");
+  }
+
+  block.size = size;
+  block.dedicated = dedicated;
+  block.free[0] = size;
+
+  // host visible blocks are mapped once, every range reads through it
+  if (memoryProperties.memoryTypes[typeIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+    void* mapped;
+    VK_CHECK_RESULT(vkMapMemory(device, block.memory, 0, VK_WHOLE_SIZE, 0, &mapped))
+    block.mapped = static_cast<unsigned char*>(mapped);
+  }
+
+  std::list<MemoryBlock>& blocks = pools[linear][typeIndex];
+  blocks.push_back(std::move(block));
+  return &blocks.back();
+}
+
+
+bool MemoryAllocator::Carve(MemoryBlock& block, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize* offset) {
+  for (auto range = block.free.begin(); range != block.free.end(); range++) {
+    const VkDeviceSize start = range->first;
+    const VkDeviceSize end = range->first + range->second;
+    const VkDeviceSize aligned = AlignUp(start, alignment);
+
+    if (aligned + size > end) {
+      continue;
+    }
+
+    // keep whatever is left either side of the aligned range
+    block.free.erase(range);
+    if (aligned > start) {
+      block.free[start] = aligned - start;
+    }
+    if (aligned + size < end) {
+      block.free[aligned + size] = end - aligned - size;
+    }
+
+    *offset = aligned;
+    return true;
+  }
+
+  return false;
+}
+
+
+MemoryAllocation MemoryAllocator::Allocate(const VkMemoryRequirements& requirements, uint32_t typeIndex, bool linear) {
+  const VkMemoryPropertyFlags flags = memoryProperties.memoryTypes[typeIndex].propertyFlags;
+
+  MemoryAllocation allocation;
+  allocation.typeIndex = typeIndex;
+  allocation.linear = linear;
+  allocation.coherent = !(flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) || (flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+  // ranges that are flushed or invalidated must cover whole atoms, so they
+  // never share one with a neighbour
+  VkDeviceSize alignment = std::max<VkDeviceSize>(requirements.alignment, 1);
+  VkDeviceSize size = requirements.size;
+  if (!allocation.coherent) {
+    alignment = std::max(alignment, nonCoherentAtomSize);
+    size = AlignUp(size, nonCoherentAtomSize);
+  }
+  allocation.size = size;
+
+  std::lock_guard<std::mutex> lock(mutex);
+
+  if (size > MEMORY_DEDICATED_SIZE) {
+    allocation.block = CreateBlock(typeIndex, linear, size, true);
+    allocation.block->free.clear();
+  }
+  else {
+    for (MemoryBlock& block : pools[linear][typeIndex]) {
+      if (!block.dedicated && Carve(block, size, alignment, &allocation.offset)) {
+        allocation.block = &block;
+        break;
+      }
+    }
+
+    if (allocation.block == nullptr) {
+      allocation.block = CreateBlock(typeIndex, linear, MEMORY_BLOCK_SIZE, false);
+      Carve(*allocation.block, size, alignment, &allocation.offset);
+    }
+  }
+
+  allocation.block->allocations++;
+  if (allocation.block->mapped != nullptr) {
+    allocation.mapped = allocation.block->mapped + allocation.offset;
+  }
+
+  return allocation;
+}
+
+
+void MemoryAllocator::Free(MemoryAllocation& allocation) {
+  if (allocation.block == nullptr) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex);
+  MemoryBlock& block = *allocation.block;
+
+  if (block.dedicated) {
+    vkFreeMemory(device, block.memory, nullptr);
+
+    std::list<MemoryBlock>& blocks = pools[allocation.linear][allocation.typeIndex];
+    blocks.remove_if([&block](const MemoryBlock& other) { return &other == &block; });
+  }
+  else {
+    // merge with the free ranges either side; empty blocks are kept for reuse
+    VkDeviceSize offset = allocation.offset;
+    VkDeviceSize size = allocation.size;
+
+    auto next = block.free.lower_bound(offset);
+    if (next != block.free.end() && offset + size == next->first) {
+      size += next->second;
+      next = block.free.erase(next);
+    }
+
+    if (next != block.free.begin()) {
+      auto previous = std::prev(next);
+      if (previous->first + previous->second == offset) {
+        offset = previous->first;
+        size += previous->second;
+        block.free.erase(previous);
+      }
+    }
+
+    block.free[offset] = size;
+    block.allocations--;
+  }
+
+  allocation = MemoryAllocation();
+}
+
+
+void MemoryAllocator::Flush(const MemoryAllocation& allocation) {
+  if (allocation.coherent) {
+    return;
+  }
+
+  VkMappedMemoryRange range = {};
+  range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+  range.memory = allocation.block->memory;
+  range.offset = allocation.offset;
+  range.size = allocation.size;
+  VK_CHECK_RESULT(vkFlushMappedMemoryRanges(device, 1, &range))
+}
+
+
+void MemoryAllocator::Invalidate(const MemoryAllocation& allocation) {
+  if (allocation.coherent) {
+    return;
+  }
+
+  VkMappedMemoryRange range = {};
+  range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+  range.memory = allocation.block->memory;
+  range.offset = allocation.offset;
+  range.size = allocation.size;
+  VK_CHECK_RESULT(vkInvalidateMappedMemoryRanges(device, 1, &range))
+}
+
+
+void MemoryAllocator::Release() {
+  // every handle holds the context, so nothing is still bound by now
+  for (auto& pool : pools) {
+    for (std::list<MemoryBlock>& blocks : pool) {
+      for (MemoryBlock& block : blocks) {
+        vkFreeMemory(device, block.memory, nullptr);
+      }
+      blocks.clear();
+    }
+  }
+}
+
+
+DeviceBuffer::DeviceBuffer(std::shared_ptr<VulkanContext> _context, VkBuffer _buffer, const MemoryAllocation& _allocation)
+  : context(std::move(_context)), allocation(_allocation), buffer(_buffer) {}
+
+
+DeviceBuffer::DeviceBuffer(DeviceBuffer&& other) noexcept
+  : context(std::move(other.context)), allocation(other.allocation), buffer(other.buffer) {
+  other.allocation = MemoryAllocation();
+  other.buffer = VK_NULL_HANDLE;
+}
+
+
+DeviceBuffer& DeviceBuffer::operator=(DeviceBuffer&& other) noexcept {
+  if (this != &other) {
+    Reset();
+    context = std::move(other.context);
+    allocation = other.allocation;
+    buffer = other.buffer;
+    other.allocation = MemoryAllocation();
+    other.buffer = VK_NULL_HANDLE;
+  }
+
+  return *this;
+}
+
+
+void DeviceBuffer::Reset() {
+  if (buffer == VK_NULL_HANDLE) {
+    return;
+  }
+
+  vkDestroyBuffer(context->device, buffer, nullptr);
+  context->allocator.Free(allocation);
+  buffer = VK_NULL_HANDLE;
+  context.reset();
+}
+
+
+void DeviceBuffer::Flush() const {
+  context->allocator.Flush(allocation);
+}
+
+
+void DeviceBuffer::Invalidate() const {
+  context->allocator.Invalidate(allocation);
+}
+
+
+DeviceImage::DeviceImage(std::shared_ptr<VulkanContext> _context, VkImage _image, VkImageView _view, const MemoryAllocation& _allocation)
+  : context(std::move(_context)), allocation(_allocation), image(_image), view(_view) {}
+
+
+DeviceImage::DeviceImage(DeviceImage&& other) noexcept
+  : context(std::move(other.context)), allocation(other.allocation), image(other.image), view(other.view) {
+  other.allocation = MemoryAllocation();
+  other.image = VK_NULL_HANDLE;
+  other.view = VK_NULL_HANDLE;
+}
+
+
+DeviceImage& DeviceImage::operator=(DeviceImage&& other) noexcept {
+  if (this != &other) {
+    Reset();
+    context = std::move(other.context);
+    allocation = other.allocation;
+    image = other.image;
+    view = other.view;
+    other.allocation = MemoryAllocation();
+    other.image = VK_NULL_HANDLE;
+    other.view = VK_NULL_HANDLE;
+  }
+
+  return *this;
+}
+
+
+void DeviceImage::Reset() {
+  if (image == VK_NULL_HANDLE) {
+    return;
+  }
+
+  vkDestroyImageView(context->device, view, nullptr);
+  vkDestroyImage(context->device, image, nullptr);
+  context->allocator.Free(allocation);
+  image = VK_NULL_HANDLE;
+  view = VK_NULL_HANDLE;
+  context.reset();
+}
@@ -0,0 +1,136 @@
+#include "discRenderer.h"
+#include <algorithm>
+#include <cstddef>
+
+
+DiscRenderer::DiscRenderer(int _width, int _height) {
+  width = _width;
+  height = _height;
+
+  PipelineShaders shaders;
+  shaders.vertex = "disc.vert.spv";
+  shaders.fragment = "disc.frag.spv";
+  shaders.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP;
+  shaders.blend = true;
+
+  VkPipelineVertexInputStateCreateInfo inputState = GetVertexInputState();
+  vulkan = new HeadlessVulkan(width, height, inputState, VK_FORMAT_R8G8B8A8_UNORM, shaders);
+
+  // unit square strip, one pixel from the centre to each edge in device
+  // units; the vertex shader scales it to the disc's reach
+  const float pixelX = 2.0f / width;
+  const float pixelY = 2.0f / height;
+  const std::array<glm::vec3, 4> corners = {{
+    {-pixelX, -pixelY, 0.0f},
+    { pixelX, -pixelY, 0.0f},
+    {-pixelX,  pixelY, 0.0f},
+    { pixelX,  pixelY, 0.0f}
+  }};
+
+  quadBuffer = vulkan->CreateBuffer(
+      VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+      sizeof(corners));
+  vulkan->CopyData(corners.data(), sizeof(corners), quadBuffer);
+
+  GenerateInstanceBuffer(1);
+}
+
+
+DiscRenderer::~DiscRenderer() {
+  // buffers hold the context, not the instance, so they may go first
+  quadBuffer.Reset();
+  instanceBuffer.Reset();
+  delete vulkan;
+}
+
+
+VkPipelineVertexInputStateCreateInfo DiscRenderer::GetVertexInputState() {
+  bindings = {};
+  attributes = {};
+
+  bindings[0].binding = 0;
+  bindings[0].stride = sizeof(glm::vec3);
+  bindings[0].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+  attributes[0].binding = 0;
+  attributes[0].location = 0;
+  attributes[0].format = VK_FORMAT_R32G32B32_SFLOAT;
+  attributes[0].offset = 0;
+
+  bindings[1].binding = 1;
+  bindings[1].stride = sizeof(DiscInstance);
+  bindings[1].inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+
+  // position and radius are read together
+  attributes[1].binding = 1;
+  attributes[1].location = 1;
+  attributes[1].format = VK_FORMAT_R32G32B32_SFLOAT;
+  attributes[1].offset = offsetof(DiscInstance, position);
+
+  attributes[2].binding = 1;
+  attributes[2].location = 2;
+  attributes[2].format = VK_FORMAT_R8G8B8A8_UNORM;
+  attributes[2].offset = offsetof(DiscInstance, color);
+
+  VkPipelineVertexInputStateCreateInfo vertexInputState = vks::initializers::pipelineVertexInputStateCreateInfo();
+  vertexInputState.vertexBindingDescriptionCount = static_cast<uint32_t>(bindings.size());
+  vertexInputState.pVertexBindingDescriptions = bindings.data();
+  vertexInputState.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributes.size());
+  vertexInputState.pVertexAttributeDescriptions = attributes.data();
+
+  return vertexInputState;
+}
+
+
+void DiscRenderer::GenerateInstanceBuffer(uint32_t len) {
+  if (len <= instanceCapacity) {
+    return;
+  }
+
+  instanceCapacity = std::max<uint32_t>(instanceCapacity, DISC_BUFFER_INCREMENT);
+  while (instanceCapacity < len) {
+    instanceCapacity *= 2;
+  }
+
+  // an async render may still be drawing from the old buffer
+  vulkan->CompletePending();
+  instanceBuffer = vulkan->CreateBuffer(
+      VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+      instanceCapacity * sizeof(DiscInstance));
+  instances = static_cast<DiscInstance*>(instanceBuffer.Mapped());
+}
+
+
+cimg_library::CImg<unsigned char> DiscRenderer::Render(const std::vector<DiscInstance>& discs, const glm::vec3& background) {
+  GenerateInstanceBuffer(discs.size());
+  vulkan->CompletePending();
+  std::copy(discs.begin(), discs.end(), instances);
+
+  VkClearColorValue clearColor;
+  clearColor.float32[0] = background.r / 255.0f;
+  clearColor.float32[1] = background.g / 255.0f;
+  clearColor.float32[2] = background.b / 255.0f;
+  clearColor.float32[3] = 1.0f;
+  vulkan->SetClearColor(clearColor);
+
+  // discs are drawn in the order given, later ones over earlier
+  std::vector<DrawBatch> batches = {{{quadBuffer, instanceBuffer}, 4, static_cast<uint32_t>(discs.size())}};
+  LabelMap view = vulkan->RenderAndMapImage(batches);
+
+  // CImg keeps each channel in a plane of its own
+  cimg_library::CImg<unsigned char> img(width, height, 1, 3);
+  for (int c = 0; c < 3; c++) {
+    for (int y = 0; y < height; y++) {
+      const unsigned char* row = view.data + static_cast<size_t>(y) * view.rowPitch + c;
+      unsigned char* out = img.data(0, y, 0, c);
+
+      for (int x = 0; x < width; x++) {
+        out[x] = row[x * 4];
+      }
+    }
+  }
+
+  return img;
+}
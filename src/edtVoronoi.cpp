@@ -0,0 +1,156 @@
+#include "edtVoronoi.h"
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+// no seed in the row
+static const int64_t EDT_INFINITY = std::numeric_limits<int64_t>::max();
+
+
+EDTVoronoi::EDTVoronoi(int _width, int _height, uint32_t threads) : workers(threads) {
+  width = _width;
+  height = _height;
+
+  const size_t pixels = static_cast<size_t>(width) * height;
+  seeds.resize(pixels);
+  rowDistances.resize(pixels);
+  rowLabels.resize(pixels);
+  labels.resize(pixels);
+}
+
+
+void EDTVoronoi::Seed(const std::vector<glm::vec2>& points) {
+  std::fill(seeds.begin(), seeds.end(), LABEL_EMPTY);
+
+  for(uint32_t i = 0; i < points.size(); i++) {
+    const int x = std::clamp(static_cast<int>(points[i].x * width), 0, width - 1);
+    const int y = std::clamp(static_cast<int>(points[i].y * height), 0, height - 1);
+
+    uint32_t& seed = seeds[static_cast<size_t>(y) * width + x];
+    seed = std::min(seed, i);
+  }
+}
+
+
+void EDTVoronoi::RowPass(int y) {
+  // nearest seed to the left, then to the right where it is strictly nearer
+  const size_t row = static_cast<size_t>(y) * width;
+  int last = -1;
+
+  for(int x = 0; x < width; x++) {
+    if(seeds[row + x] != LABEL_EMPTY) {
+      last = x;
+    }
+
+    if(last < 0) {
+      rowDistances[row + x] = EDT_INFINITY;
+      rowLabels[row + x] = LABEL_EMPTY;
+    }
+    else {
+      rowDistances[row + x] = static_cast<int64_t>(x - last) * (x - last);
+      rowLabels[row + x] = seeds[row + last];
+    }
+  }
+
+  last = -1;
+  for(int x = width - 1; x >= 0; x--) {
+    if(seeds[row + x] != LABEL_EMPTY) {
+      last = x;
+    }
+
+    if(last >= 0) {
+      const int64_t distance = static_cast<int64_t>(last - x) * (last - x);
+      if(distance < rowDistances[row + x]) {
+        rowDistances[row + x] = distance;
+        rowLabels[row + x] = seeds[row + last];
+      }
+    }
+  }
+}
+
+
+void EDTVoronoi::ColumnPass(int x, std::vector<int>& parabolas, std::vector<double>& bounds) {
+  // lower envelope of (y - q)^2 + f(q) over the rows q that reached a seed;
+  // parabolas[k] holds the row of the k-th envelope parabola, which is the
+  // lowest between bounds[k] and bounds[k + 1]
+  auto f = [&](int q) { return rowDistances[static_cast<size_t>(q) * width + x]; };
+
+  int count = 0;
+  for(int q = 0; q < height; q++) {
+    if(f(q) == EDT_INFINITY) continue;
+
+    const double fq = static_cast<double>(f(q)) + static_cast<double>(q) * q;
+    double s = 0.0;
+
+    while(count > 0) {
+      const int p = parabolas[count - 1];
+      s = (fq - (static_cast<double>(f(p)) + static_cast<double>(p) * p)) / (2.0 * (q - p));
+      if(s > bounds[count - 1]) break;
+      count--;
+    }
+
+    parabolas[count] = q;
+    bounds[count] = count == 0 ? -std::numeric_limits<double>::infinity() : s;
+    count++;
+  }
+
+  if(count == 0) {
+    for(int y = 0; y < height; y++) {
+      labels[static_cast<size_t>(y) * width + x] = LABEL_EMPTY;
+    }
+    return;
+  }
+
+  bounds[count] = std::numeric_limits<double>::infinity();
+
+  int k = 0;
+  for(int y = 0; y < height; y++) {
+    while(bounds[k + 1] < y) {
+      k++;
+    }
+
+    labels[static_cast<size_t>(y) * width + x] = rowLabels[static_cast<size_t>(parabolas[k]) * width + x];
+  }
+}
+
+
+LabelMap EDTVoronoi::GetLabelMap(const std::vector<glm::vec2>& points) {
+  Seed(points);
+
+  workers.ParallelFor(height, [&](uint32_t y) {
+    RowPass(y);
+  });
+
+  // strips of neighbouring columns share the cache lines of each row
+  const uint32_t strips = (width + EDT_COLUMN_STRIP - 1) / EDT_COLUMN_STRIP;
+  workers.ParallelFor(strips, [&](uint32_t strip) {
+    std::vector<int> parabolas(height);
+    std::vector<double> bounds(height + 1);
+
+    const int end = std::min<int>((strip + 1) * EDT_COLUMN_STRIP, width);
+    for(int x = strip * EDT_COLUMN_STRIP; x < end; x++) {
+      ColumnPass(x, parabolas, bounds);
+    }
+  });
+
+  // valid until the next call overwrites the buffer
+  LabelMap view;
+  view.data = reinterpret_cast<const unsigned char*>(labels.data());
+  view.rowPitch = width * sizeof(uint32_t);
+  view.width = width;
+  view.height = height;
+  view.bytesPerLabel = sizeof(uint32_t);
+  return view;
+}
+
+
+cimg_library::CImg<uint32_t> EDTVoronoi::GetImage(const std::vector<glm::vec2>& points) {
+  LabelMap map = GetLabelMap(points);
+  cimg_library::CImg<uint32_t> out(width, height, 1, 1);
+
+  for(int y = 0; y < height; y++) {
+    memcpy(out.data(0, y), map.Row(y), width * sizeof(uint32_t));
+  }
+
+  return out;
+}
@@ -0,0 +1,82 @@
+#include "embeddedShaders.h"
+
+// the shaders target compiles each shader to a list of words with
+// glslc -mfmt=num, included here as constant data
+static constexpr uint32_t vert[] = {
+#include "shaders/vert.spv.inc"
+};
+
+static constexpr uint32_t frag[] = {
+#include "shaders/frag.spv.inc"
+};
+
+static constexpr uint32_t quadVert[] = {
+#include "shaders/quad.vert.spv.inc"
+};
+
+static constexpr uint32_t quadFrag[] = {
+#include "shaders/quad.frag.spv.inc"
+};
+
+static constexpr uint32_t layeredVert[] = {
+#include "shaders/layered.vert.spv.inc"
+};
+
+static constexpr uint32_t quadLayeredVert[] = {
+#include "shaders/quad.layered.vert.spv.inc"
+};
+
+static constexpr uint32_t discVert[] = {
+#include "shaders/disc.vert.spv.inc"
+};
+
+static constexpr uint32_t discFrag[] = {
+#include "shaders/disc.frag.spv.inc"
+};
+
+static constexpr uint32_t moments[] = {
+#include "shaders/moments.comp.spv.inc"
+};
+
+static constexpr uint32_t jfaSeed[] = {
+#include "shaders/jfaSeed.comp.spv.inc"
+};
+
+static constexpr uint32_t jfaStep[] = {
+#include "shaders/jfaStep.comp.spv.inc"
+};
+
+static constexpr uint32_t lbgDecide[] = {
+#include "shaders/lbgDecide.comp.spv.inc"
+};
+
+static constexpr uint32_t lbgFinalize[] = {
+#include "shaders/lbgFinalize.comp.spv.inc"
+};
+
+static constexpr EmbeddedShader shaders[] = {
+  { "vert.spv", vert, sizeof(vert) },
+  { "frag.spv", frag, sizeof(frag) },
+  { "quad.vert.spv", quadVert, sizeof(quadVert) },
+  { "quad.frag.spv", quadFrag, sizeof(quadFrag) },
+  { "layered.vert.spv", layeredVert, sizeof(layeredVert) },
+  { "quad.layered.vert.spv", quadLayeredVert, sizeof(quadLayeredVert) },
+  { "disc.vert.spv", discVert, sizeof(discVert) },
+  { "disc.frag.spv", discFrag, sizeof(discFrag) },
+  { "moments.comp.spv", moments, sizeof(moments) },
+  { "jfaSeed.comp.spv", jfaSeed, sizeof(jfaSeed) },
+  { "jfaStep.comp.spv", jfaStep, sizeof(jfaStep) },
+  { "lbgDecide.comp.spv", lbgDecide, sizeof(lbgDecide) },
+  { "lbgFinalize.comp.spv", lbgFinalize, sizeof(lbgFinalize) }
+};
+
+
+const EmbeddedShader* FindEmbeddedShader(const std::string& name) {
+  for (const EmbeddedShader& shader : shaders) {
+    if (name == shader.name) {
+      return &shader;
+    }
+  }
+
+  return nullptr;
+}
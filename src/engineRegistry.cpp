@@ -0,0 +1,174 @@
+#include "engineRegistry.h"
+#include "jfaVoronoi.h"
+#include "cpuJfaVoronoi.h"
+#include "exactVoronoi.h"
+#include "edtVoronoi.h"
+#include "tileVoronoi.h"
+#include "vulkanLoader.h"
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <unistd.h>
+
+
+const std::vector<EngineEntry>& GetEngines() {
+  // footprints count the host side only: the labels and density a device
+  // engine keeps on the host, mapped for a single tile and gathered tile by
+  // tile otherwise, and the label buffers and tables of the host ones. Jump flooding and the distance transform seed one site per pixel,
+  // so a site sharing a pixel loses its cell; Auto passes them over
+  static const std::vector<EngineEntry> engines = {
+    {"cones", EngineType::Raster, VoronoiMode::Cones, true, true, 8,
+      [](int width, int height, uint32_t maxPoints) -> VoronoiEngine* { return new GPUVoronoi(width, height, maxPoints, VoronoiMode::Cones); }},
+    {"quads", EngineType::Raster, VoronoiMode::Quads, true, true, 8,
+      [](int width, int height, uint32_t maxPoints) -> VoronoiEngine* { return new GPUVoronoi(width, height, maxPoints, VoronoiMode::Quads); }},
+    {"jfa", EngineType::JumpFlood, VoronoiMode::Cones, true, false, 4,
+      [](int width, int height, uint32_t maxPoints) -> VoronoiEngine* { return new JFAVoronoi(width, height); }},
+    {"cpu", EngineType::CpuJumpFlood, VoronoiMode::Cones, false, false, 8,
+      [](int width, int height, uint32_t maxPoints) -> VoronoiEngine* { return new CPUJFAVoronoi(width, height); }},
+    {"exact", EngineType::Exact, VoronoiMode::Cones, false, true, 17,
+      [](int width, int height, uint32_t maxPoints) -> VoronoiEngine* { return new ExactVoronoi(width, height); }},
+    {"edt", EngineType::DistanceTransform, VoronoiMode::Cones, false, false, 20,
+      [](int width, int height, uint32_t maxPoints) -> VoronoiEngine* { return new EDTVoronoi(width, height); }},
+    {"tiles", EngineType::Tiled, VoronoiMode::Cones, false, true, 4,
+      [](int width, int height, uint32_t maxPoints) -> VoronoiEngine* { return new TileVoronoi(width, height); }},
+  };
+
+  return engines;
+}
+
+
+const EngineEntry* FindEngine(const std::string& name) {
+  for(const EngineEntry& entry : GetEngines()) {
+    if(name == entry.name) {
+      return &entry;
+    }
+  }
+
+  return nullptr;
+}
+
+
+const EngineEntry* FindEngine(EngineType type, VoronoiMode mode) {
+  for(const EngineEntry& entry : GetEngines()) {
+    if(entry.type == type && (type != EngineType::Raster || entry.mode == mode)) {
+      return &entry;
+    }
+  }
+
+  return nullptr;
+}
+
+
+bool EngineAvailable(const EngineEntry& entry) {
+  return !entry.device || VulkanDeviceAvailable();
+}
+
+
+VoronoiEngine* CreateUnpooledEngine(const EngineEntry& entry, int width, int height, uint32_t maxPoints) {
+  VoronoiEngine* engine = entry.create(width, height, maxPoints);
+
+  if(entry.type == EngineType::Raster) {
+    static_cast<GPUVoronoi*>(engine)->KeepSurface(false);
+  }
+
+  return engine;
+}
+
+
+double BenchmarkEngine(VoronoiEngine* engine, const cimg_library::CImg<unsigned char>& img,
+                       const std::vector<glm::vec2>& points, const std::vector<float>& radii) {
+  auto iterate = [&]() {
+    const auto start = std::chrono::steady_clock::now();
+
+    if(engine->SupportsMoments()) {
+      engine->GetCells(points, radii);
+    }
+    else {
+      std::vector<VoronoiCell> voronoi(points.size());
+      engine->StreamLabelMap(points, radii, [&](const LabelMap& map, const LabelRegion& region) {
+        AccumulateVoronoiCells(voronoi, map, img, region);
+      });
+      FinalizeVoronoiCells(voronoi, img.width(), img.height());
+    }
+
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+  };
+
+  // the first iteration pays for pipelines and first allocations, so it
+  // only stands in for the engine when it is already too slow to matter
+  double elapsed = iterate();
+  if(elapsed < ENGINE_BENCHMARK_CAP_MS) {
+    elapsed = iterate();
+  }
+
+  // the benchmark's device time is not the solve's
+  engine->TakeTimings();
+  return elapsed;
+}
+
+
+static size_t PhysicalMemory() {
+  const long pages = sysconf(_SC_PHYS_PAGES);
+  const long pageSize = sysconf(_SC_PAGE_SIZE);
+  if(pages <= 0 || pageSize <= 0) {
+    return std::numeric_limits<size_t>::max();
+  }
+
+  return static_cast<size_t>(pages) * static_cast<size_t>(pageSize);
+}
+
+
+const EngineEntry& SelectEngine(const cimg_library::CImg<unsigned char>& crop, const std::vector<glm::vec2>& points,
+                                const std::vector<float>& radii, int width, int height) {
+  const EngineEntry* best = nullptr;
+  double bestTime = std::numeric_limits<double>::infinity();
+  const size_t budget = PhysicalMemory() / ENGINE_MEMORY_SHARE;
+  const size_t pixels = static_cast<size_t>(width) * height;
+
+  for(const EngineEntry& entry : GetEngines()) {
+    if(!entry.selectable) {
+      std::cout << "engine " << entry.name << ": drops sites sharing a pixel, only run when named" << std::endl;
+      continue;
+    }
+
+    if(entry.bytesPerPixel * pixels > budget) {
+      std::cout << "engine " << entry.name << ": needs " << entry.bytesPerPixel * pixels / (1 << 20) << "MB" << std::endl;
+      continue;
+    }
+
+    if(!EngineAvailable(entry)) {
+      std::cout << "engine " << entry.name << ": no Vulkan device" << std::endl;
+      continue;
+    }
+
+    VoronoiEngine* engine = nullptr;
+    try {
+      engine = CreateUnpooledEngine(entry, crop.width(), crop.height(), points.size());
+      if(engine->SupportsMoments()) {
+        engine->SetDensity(crop);
+      }
+
+      const double time = BenchmarkEngine(engine, crop, points, radii);
+      std::cout << "engine " << entry.name << ": " << std::fixed << std::setprecision(2) << time << "ms per iteration" << std::defaultfloat << std::endl;
+
+      if(time < bestTime) {
+        best = &entry;
+        bestTime = time;
+      }
+    }
+    catch(const std::exception& e) {
+      std::cout << "engine " << entry.name << ": " << e.what() << std::endl;
+    }
+
+    delete engine;
+  }
+
+  if(best == nullptr) {
+    throw std::runtime_error("no Voronoi engine could run!");
+  }
+
+  std::cout << "selected engine " << best->name << std::endl;
+  return *best;
+}
@@ -0,0 +1,303 @@
+#include "exactVoronoi.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+
+// keeps the part of a convex polygon where dot(v, normal) <= offset
+static void ClipPolygon(std::vector<glm::dvec2>& polygon, std::vector<glm::dvec2>& clipped, const glm::dvec2& normal, double offset) {
+  clipped.clear();
+
+  for(size_t k = 0; k < polygon.size(); k++) {
+    const glm::dvec2& a = polygon[k];
+    const glm::dvec2& b = polygon[(k + 1) % polygon.size()];
+    const double da = glm::dot(a, normal) - offset;
+    const double db = glm::dot(b, normal) - offset;
+
+    if(da <= 0.0) {
+      clipped.push_back(a);
+    }
+    if((da <= 0.0) != (db <= 0.0)) {
+      clipped.push_back(a + (b - a) * (da / (da - db)));
+    }
+  }
+
+  polygon.swap(clipped);
+}
+
+
+// calls span(y, begin, end) for the pixels of each row whose centres lie in
+// the polygon, half open in x so neighbouring cells never share a pixel
+template <typename Span>
+static void ForEachSpan(const std::vector<glm::dvec2>& polygon, int width, int height, Span span) {
+  if(polygon.size() < 3) {
+    return;
+  }
+
+  double top = polygon[0].y, bottom = polygon[0].y;
+  for(const glm::dvec2& v : polygon) {
+    top = std::min(top, v.y);
+    bottom = std::max(bottom, v.y);
+  }
+
+  const int y0 = std::max(0, static_cast<int>(std::ceil(top - 0.5)));
+  const int y1 = std::min(height, static_cast<int>(std::ceil(bottom - 0.5)));
+
+  for(int y = y0; y < y1; y++) {
+    const double centre = y + 0.5;
+    double left = width, right = 0.0;
+
+    // a convex polygon crosses the row on exactly two edges
+    for(size_t k = 0; k < polygon.size(); k++) {
+      const glm::dvec2& a = polygon[k];
+      const glm::dvec2& b = polygon[(k + 1) % polygon.size()];
+      if(a.y == b.y || centre < std::min(a.y, b.y) || centre > std::max(a.y, b.y)) continue;
+
+      const double x = a.x + (centre - a.y) * (b.x - a.x) / (b.y - a.y);
+      left = std::min(left, x);
+      right = std::max(right, x);
+    }
+
+    const int begin = std::max(0, static_cast<int>(std::ceil(left - 0.5)));
+    const int end = std::min(width, static_cast<int>(std::ceil(right - 0.5)));
+    if(begin < end) {
+      span(y, begin, end);
+    }
+  }
+}
+
+
+ExactVoronoi::ExactVoronoi(int _width, int _height, uint32_t threads) : workers(threads) {
+  width = _width;
+  height = _height;
+}
+
+
+void ExactVoronoi::SetDensity(const cimg_library::CImg<unsigned char>& img) {
+  const size_t stride = static_cast<size_t>(width) + 1;
+  blocksPerRow = width / EXACT_PREFIX_BLOCK + 1;
+  partials.assign(stride * height, glm::vec3(0.0f));
+  bases.assign(static_cast<size_t>(blocksPerRow) * height, glm::dvec3(0.0));
+
+  workers.ParallelFor(height, [&](uint32_t y) {
+    glm::vec3* partial = partials.data() + y * stride;
+    glm::dvec3* base = bases.data() + static_cast<size_t>(y) * blocksPerRow;
+    glm::dvec3 sum(0.0);
+
+    for(int x = 0; x < width; x++) {
+      const int u = x % EXACT_PREFIX_BLOCK;
+      const double density = Density(img(x, y));
+      sum += glm::dvec3(density, x * density, static_cast<double>(x) * x * density);
+
+      // a block's first entry is zero, the row before it is in its base
+      if(u == EXACT_PREFIX_BLOCK - 1) {
+        base[(x + 1) / EXACT_PREFIX_BLOCK] = sum;
+      }
+      else {
+        partial[x + 1] = partial[x] + glm::vec3(density, u * density, static_cast<float>(u * u) * density);
+      }
+    }
+  });
+}
+
+
+glm::dvec3 ExactVoronoi::Prefix(int y, int x) const {
+  // sums over [0, x) of row y, moved from the block's origin back to the row's
+  const int block = x / EXACT_PREFIX_BLOCK;
+  const double origin = block * EXACT_PREFIX_BLOCK;
+  const glm::dvec3 local(partials[y * (static_cast<size_t>(width) + 1) + x]);
+  const glm::dvec3& base = bases[static_cast<size_t>(y) * blocksPerRow + block];
+
+  return glm::dvec3(base.x + local.x,
+                    base.y + local.y + origin * local.x,
+                    base.z + local.z + 2.0 * origin * local.y + origin * origin * local.x);
+}
+
+
+void ExactVoronoi::BuildGrid(const std::vector<glm::vec2>& points) {
+  sites.resize(points.size());
+  for(size_t i = 0; i < points.size(); i++) {
+    sites[i] = glm::dvec2(points[i]) * glm::dvec2(width, height);
+  }
+
+  // square bins holding a couple of sites each on average
+  binSize = std::sqrt(static_cast<double>(width) * height * EXACT_SITES_PER_BIN / std::max<size_t>(points.size(), 1));
+  binsX = std::max(1, static_cast<int>(std::ceil(width / binSize)));
+  binsY = std::max(1, static_cast<int>(std::ceil(height / binSize)));
+
+  std::vector<uint32_t> bins(sites.size());
+  binStarts.assign(static_cast<size_t>(binsX) * binsY + 1, 0);
+  for(size_t i = 0; i < sites.size(); i++) {
+    const int bx = std::clamp(static_cast<int>(sites[i].x / binSize), 0, binsX - 1);
+    const int by = std::clamp(static_cast<int>(sites[i].y / binSize), 0, binsY - 1);
+    bins[i] = by * binsX + bx;
+    binStarts[bins[i] + 1]++;
+  }
+
+  for(size_t b = 1; b < binStarts.size(); b++) {
+    binStarts[b] += binStarts[b - 1];
+  }
+
+  // sites stay in index order within a bin
+  std::vector<uint32_t> next(binStarts.begin(), binStarts.end() - 1);
+  binSites.resize(sites.size());
+  for(size_t i = 0; i < sites.size(); i++) {
+    binSites[next[bins[i]]++] = i;
+  }
+}
+
+
+std::vector<glm::dvec2> ExactVoronoi::GetCellPolygon(uint32_t site) {
+  const glm::dvec2 p = sites[site];
+  std::vector<glm::dvec2> polygon = {{0.0, 0.0}, {double(width), 0.0}, {double(width), double(height)}, {0.0, double(height)}};
+  std::vector<glm::dvec2> clipped;
+  clipped.reserve(16);
+
+  const int bx = std::clamp(static_cast<int>(p.x / binSize), 0, binsX - 1);
+  const int by = std::clamp(static_cast<int>(p.y / binSize), 0, binsY - 1);
+  const int rings = std::max(binsX, binsY);
+
+  // a site in ring r is at least (r - 1) bins away and its bisector can only
+  // cut the cell if it lies within twice the cell's furthest vertex
+  double reach = std::numeric_limits<double>::infinity();
+  for(int ring = 0; ring <= rings; ring++) {
+    if(ring > 0 && (ring - 1) * binSize >= 2.0 * reach) {
+      break;
+    }
+
+    for(int y = by - ring; y <= by + ring; y++) {
+      if(y < 0 || y >= binsY) continue;
+
+      // the ring's top and bottom rows in full, only its ends in between
+      const int step = (y == by - ring || y == by + ring) ? 1 : std::max(2 * ring, 1);
+      for(int x = bx - ring; x <= bx + ring; x += step) {
+        if(x < 0 || x >= binsX) continue;
+
+        const uint32_t bin = y * binsX + x;
+        for(uint32_t k = binStarts[bin]; k < binStarts[bin + 1]; k++) {
+          const uint32_t other = binSites[k];
+          if(other == site) continue;
+
+          const glm::dvec2 d = sites[other] - p;
+          if(d.x == 0.0 && d.y == 0.0) {
+            // coincident sites, the lower index takes the cell
+            if(other < site) {
+              return {};
+            }
+            continue;
+          }
+
+          // the half plane nearer this site than the other
+          ClipPolygon(polygon, clipped, d, glm::dot(d, p) + 0.5 * glm::dot(d, d));
+          if(polygon.empty()) {
+            return polygon;
+          }
+        }
+      }
+    }
+
+    double furthest = 0.0;
+    for(const glm::dvec2& v : polygon) {
+      furthest = std::max(furthest, glm::dot(v - p, v - p));
+    }
+    reach = std::sqrt(furthest);
+  }
+
+  return polygon;
+}
+
+
+VoronoiCell ExactVoronoi::IntegrateCell(const std::vector<glm::dvec2>& polygon) {
+  double area = 0.0, m00 = 0.0, m10 = 0.0, m01 = 0.0, m11 = 0.0, m20 = 0.0, m02 = 0.0;
+
+  // the same sums AccumulateVoronoiCells makes pixel by pixel
+  ForEachSpan(polygon, width, height, [&](int y, int begin, int end) {
+    const glm::dvec3 sums = Prefix(y, end) - Prefix(y, begin);
+    const double s0 = sums.x, s1 = sums.y, s2 = sums.z;
+
+    area += end - begin;
+    m00 += s0;
+    m10 += s1;
+    m01 += y * s0;
+    m11 += y * s1;
+    m20 += s2;
+    m02 += static_cast<double>(y) * y * s0;
+  });
+
+  VoronoiCell cell;
+  cell.area = area;
+  cell.m00 = m00;
+  cell.m10 = m10;
+  cell.m01 = m01;
+  cell.m11 = m11;
+  cell.m20 = m20;
+  cell.m02 = m02;
+  return cell;
+}
+
+
+std::vector<VoronoiCell> ExactVoronoi::GetCells(const std::vector<glm::vec2>& points, const std::vector<float>& radii) {
+  if(partials.empty()) {
+    throw std::runtime_error("no density to reduce moments against!");
+  }
+
+  BuildGrid(points);
+
+  // cells are independent, so sites are simply shared out in chunks
+  std::vector<VoronoiCell> voronoi(points.size());
+  const uint32_t chunks = (points.size() + EXACT_SITE_CHUNK - 1) / EXACT_SITE_CHUNK;
+  workers.ParallelFor(chunks, [&](uint32_t chunk) {
+    const uint32_t end = std::min<uint32_t>((chunk + 1) * EXACT_SITE_CHUNK, points.size());
+    for(uint32_t i = chunk * EXACT_SITE_CHUNK; i < end; i++) {
+      voronoi[i] = IntegrateCell(GetCellPolygon(i));
+    }
+  });
+
+  FinalizeVoronoiCells(voronoi, width, height);
+  return voronoi;
+}
+
+
+LabelMap ExactVoronoi::GetLabelMap(const std::vector<glm::vec2>& points) {
+  BuildGrid(points);
+
+  std::vector<std::vector<glm::dvec2>> polygons(points.size());
+  const uint32_t chunks = (points.size() + EXACT_SITE_CHUNK - 1) / EXACT_SITE_CHUNK;
+  workers.ParallelFor(chunks, [&](uint32_t chunk) {
+    const uint32_t end = std::min<uint32_t>((chunk + 1) * EXACT_SITE_CHUNK, points.size());
+    for(uint32_t i = chunk * EXACT_SITE_CHUNK; i < end; i++) {
+      polygons[i] = GetCellPolygon(i);
+    }
+  });
+
+  // pixels no span reaches keep the empty label
+  labels.assign(static_cast<size_t>(width) * height, LABEL_EMPTY);
+  for(uint32_t i = 0; i < polygons.size(); i++) {
+    ForEachSpan(polygons[i], width, height, [&](int y, int begin, int end) {
+      std::fill(labels.begin() + static_cast<size_t>(y) * width + begin, labels.begin() + static_cast<size_t>(y) * width + end, i);
+    });
+  }
+
+  // valid until the next call overwrites the buffer
+  LabelMap view;
+  view.data = reinterpret_cast<const unsigned char*>(labels.data());
+  view.rowPitch = width * sizeof(uint32_t);
+  view.width = width;
+  view.height = height;
+  view.bytesPerLabel = sizeof(uint32_t);
+  return view;
+}
+
+
+cimg_library::CImg<uint32_t> ExactVoronoi::GetImage(const std::vector<glm::vec2>& points) {
+  LabelMap map = GetLabelMap(points);
+  cimg_library::CImg<uint32_t> out(width, height, 1, 1);
+
+  for(int y = 0; y < height; y++) {
+    memcpy(out.data(0, y), map.Row(y), width * sizeof(uint32_t));
+  }
+
+  return out;
+}
@@ -1,37 +1,90 @@
 #include "gpuVoronoi.h"
 #include <cmath>
+#include <cstring>
+#include <cstddef>
+#include <algorithm>
+#include <map>
+#include <mutex>
 
-uint8_t GPUVoronoi::ConeSlices(const float& radius, const float& epsilon) {
-  const float alpha = 2.0f * std::acos((radius - epsilon) / radius);
-  return static_cast<uint>(2 * PI / alpha + .05f) * 2;
+
+static void DestroySurface(VoronoiSurface& surface) {
+  // level buffers go back to the shared allocator on their own
+  surface.lods.clear();
+  delete surface.vulkan;
 }
 
 
-std::vector<glm::vec3> GPUVoronoi::GenerateConeData() {
-  const float radius = std::sqrt(2.0f);
-  const float epsilon = 1.0f / (width > height ? width : height); 
-  const uint slices = ConeSlices(radius, epsilon);
-  std::cout << slices << std::endl;
+// surfaces no solver is using, kept for the rest of the process so batch runs
+// only build each resolution once; a surface belongs to one solver at a time
+struct SurfacePool {
+  std::mutex mutex;
+  std::map<SurfaceKey, std::vector<VoronoiSurface>> idle;
 
-  const float deltaTheta = 2.0f * PI / slices;
-  const float coneHeight = 1.99f;
+  ~SurfacePool() {
+    for(auto& entry : idle) {
+      for(VoronoiSurface& surface : entry.second) {
+        DestroySurface(surface);
+      }
+    }
+  }
+};
+
+
+static SurfacePool& GetSurfacePool() {
+  static SurfacePool pool;
+  return pool;
+}
+
+uint32_t GPUVoronoi::ConeSlices(const float& radius, const float& epsilon) {
+  // cones smaller than the tolerance still need a closed fan
+  if(radius <= epsilon) {
+    return 8;
+  }
+
+  const float alpha = 2.0f * std::acos((radius - epsilon) / radius);
+  return std::max<uint32_t>(static_cast<uint32_t>(2 * PI / alpha + .05f) * 2, 8);
+}
 
-  std::vector<glm::vec3> pts(slices);
-  pts.emplace_back(0.0f, 0.0f, coneHeight);
 
+std::vector<glm::vec3> GPUVoronoi::GenerateConeData(float radius) {
+  // unit cone, scaled per instance in the vertex shader; tessellated so the
+  // largest cone drawn with it stays within a pixel of a true circle
+  const float epsilon = 2.0f / (width > height ? width : height);
+  const uint32_t slices = ConeSlices(radius, epsilon);
+
+  const float deltaTheta = 2.0f * PI / slices;
   const float aspect = static_cast<float>(width) / height; 
 
-  for (uint i = 0; i < slices; i++) {
-    pts.emplace_back(radius*std::cos(i*deltaTheta),
-                      aspect * radius * std::sin(i*deltaTheta),
-                      coneHeight-radius);
+  std::vector<glm::vec3> pts;
+  pts.reserve(slices + 2);
+  pts.emplace_back(0.0f, 0.0f, 0.0f);
+
+  // depth is distance from the apex, normalised so the image diagonal fits
+  for (uint32_t i = 0; i < slices; i++) {
+    pts.emplace_back(std::cos(i*deltaTheta),
+                      aspect * std::sin(i*deltaTheta),
+                      1.0f / depthRange);
   }
 
-  pts.emplace_back(radius, 0.0f, coneHeight-radius);
+  pts.emplace_back(1.0f, 0.0f, 1.0f / depthRange);
   return pts;
 }
 
 
+std::vector<glm::vec3> GPUVoronoi::GenerateQuadData() {
+  // unit square strip, xy as for the cone rim and z the depth at unit
+  // distance; the fragment shader takes the sign of xy as the corner offset
+  const float aspect = static_cast<float>(width) / height; 
+
+  return {
+    {-1.0f, -aspect, 1.0f / depthRange},
+    { 1.0f, -aspect, 1.0f / depthRange},
+    {-1.0f,  aspect, 1.0f / depthRange},
+    { 1.0f,  aspect, 1.0f / depthRange}
+  };
+}
+
+
 VkPipelineVertexInputStateCreateInfo GPUVoronoi::GetVertexInputState() {
 
   bindings = {};
@@ -47,121 +100,597 @@ VkPipelineVertexInputStateCreateInfo GPUVoronoi::GetVertexInputState() {
   attributes[0].offset = 0;
 
   bindings[1].binding = 1;
-  bindings[1].stride = sizeof(glm::vec2);
+  bindings[1].stride = sizeof(ConeInstance);
   bindings[1].inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
 
+  // position and radius are read together
   attributes[1].binding = 1;
   attributes[1].location = 1;
-  attributes[1].format = VK_FORMAT_R32G32_SFLOAT;
-  attributes[1].offset = 0;
+  attributes[1].format = VK_FORMAT_R32G32B32_SFLOAT;
+  attributes[1].offset = offsetof(ConeInstance, position);
+
+  attributes[2].binding = 1;
+  attributes[2].location = 2;
+  attributes[2].format = VK_FORMAT_R32_UINT;
+  attributes[2].offset = offsetof(ConeInstance, label);
 
+  // layers come from a stream of their own, ConeInstance is shared with the
+  // resident compute pass and keeps its layout
   bindings[2].binding = 2;
-  bindings[2].stride = sizeof(glm::vec3);
+  bindings[2].stride = sizeof(uint32_t);
   bindings[2].inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
 
-  attributes[2].binding = 2;
-  attributes[2].location = 2;
-  attributes[2].format = VK_FORMAT_R32G32B32_SFLOAT;
-  attributes[2].offset = 0;
-
+  attributes[3].binding = 2;
+  attributes[3].location = 3;
+  attributes[3].format = VK_FORMAT_R32_UINT;
+  attributes[3].offset = 0;
 
   VkPipelineVertexInputStateCreateInfo vertexInputState = vks::initializers::pipelineVertexInputStateCreateInfo();
-  vertexInputState.vertexBindingDescriptionCount = static_cast<uint32_t>(bindings.size());
+  vertexInputState.vertexBindingDescriptionCount = layers > 1 ? 3 : 2;
   vertexInputState.pVertexBindingDescriptions = bindings.data();
-  vertexInputState.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributes.size());
+  vertexInputState.vertexAttributeDescriptionCount = layers > 1 ? 4 : 3;
   vertexInputState.pVertexAttributeDescriptions = attributes.data();
 
   return vertexInputState;
 }
 
 
-void GPUVoronoi::GenerateConeBuffer() {
+void GPUVoronoi::GenerateConeLODs() {
+  // levels halve in radius from a cone that covers the whole image down to a
+  // few pixels, so small cones are both cheaply tessellated and cheaply filled
+  const float minRadius = 2.0f * MIN_CONE_RADIUS / width;
 
-  if(coneBufferSize > 0) {
-    VkDevice device = computePipeline->GetDevice();
-    vkDestroyBuffer(device, coneBuffer, nullptr);
-    vkFreeMemory(device, coneMemory, nullptr);
+  std::vector<float> radii = {fullRadius};
+
+  // a quad costs four vertices at any size, a single level serves every site
+  while(mode == VoronoiMode::Cones && radii.size() < MAX_DRAW_BATCHES && radii.back() / 2.0f >= minRadius) {
+    radii.push_back(radii.back() / 2.0f);
   }
 
-  // generate buffers and copy data
-  std::vector<glm::vec3> coneVertices = GenerateConeData();
-  coneBufferSize = coneVertices.size();
+  // finest level first
+  std::reverse(radii.begin(), radii.end());
 
-  computePipeline->CreateBuffer(
-      VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-      &coneBuffer,
-      &coneMemory,
-      coneBufferSize*sizeof(glm::vec3));
+  lods.resize(radii.size());
+  for(size_t i = 0; i < radii.size(); i++) {
+    ConeLOD& lod = lods[i];
+    lod.radius = radii[i];
+
+    std::vector<glm::vec3> coneVertices = mode == VoronoiMode::Quads ? GenerateQuadData() : GenerateConeData(lod.radius);
+    lod.coneBufferSize = coneVertices.size();
+
+    lod.coneBuffer = computePipeline->CreateBuffer(
+        VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        lod.coneBufferSize*sizeof(glm::vec3));
   
-  // copy vertex data into cone buffer
-  computePipeline->CopyData(coneVertices.data(), coneBufferSize * sizeof(glm::vec3), coneBuffer, &coneMemory);
+    // copy vertex data into cone buffer
+    computePipeline->CopyData(coneVertices.data(), lod.coneBufferSize * sizeof(glm::vec3), lod.coneBuffer);
+
+    // every level is always bound, even when it draws nothing
+    GenerateInstanceBuffer(lod, 1);
+  }
 }
 
 
-void GPUVoronoi::GenerateColorBuffer(uint32_t len) {
-  // create single color buffer, resize as necessary
-  
-  if(len > colorBufferSize) {
-    if(colorBufferSize > 0) {
-      VkDevice device = computePipeline->GetDevice();
-      vkDestroyBuffer(device, colorBuffer, nullptr);
-      vkFreeMemory(device, colorMemory, nullptr);
+void GPUVoronoi::GenerateInstanceBuffer(ConeLOD& lod, uint32_t len) {
+  // instances live in a host visible buffer per level that stays mapped for
+  // the lifetime of the solver; it only grows, and geometrically, so a solve
+  // touches the allocator a handful of times rather than every iteration
+
+  if(len <= lod.instanceBufferSize) {
+    return;
+  }
+
+  lod.instanceBufferSize = std::max<uint32_t>(lod.instanceBufferSize, BUFFER_INCREMENT);
+  while(lod.instanceBufferSize < len) {
+    lod.instanceBufferSize *= 2;
+  }
+
+  // an async render may still be drawing from the old buffer
+  computePipeline->CompletePending();
+  lod.instanceBuffer = computePipeline->CreateBuffer(
+      VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+      lod.instanceBufferSize*sizeof(ConeInstance));
+  lod.instances = static_cast<ConeInstance*>(lod.instanceBuffer.Mapped());
+
+  if(layers > 1) {
+    lod.layerBuffer = computePipeline->CreateBuffer(
+        VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        lod.instanceBufferSize*sizeof(uint32_t));
+    lod.instanceLayers = static_cast<uint32_t*>(lod.layerBuffer.Mapped());
+  }
+}
+
+
+uint32_t GPUVoronoi::GetLODIndex(float radius) {
+  // coarsest level is the full cone, each finer level halves the radius
+  const uint32_t coarsest = lods.size() - 1;
+  if(radius >= fullRadius) {
+    return coarsest;
+  }
+
+  const uint32_t halvings = static_cast<uint32_t>(std::floor(std::log2(fullRadius / radius)));
+  return halvings >= coarsest ? 0 : coarsest - halvings;
+}
+
+
+void GPUVoronoi::UploadPoints(const std::vector<glm::vec2>& points, const std::vector<float>& radii) {
+  UploadInstances(points, radii, {0});
+}
+
+
+void GPUVoronoi::UploadInstances(const std::vector<glm::vec2>& points, const std::vector<float>& radii, const std::vector<uint32_t>& layerStarts) {
+  // layerStarts holds the index of each layer's first point, labels count
+  // from zero again in every layer; radii are given in pixels, cones are drawn in x axis device units; an
+  // empty set of radii draws every cone at full reach
+  std::vector<float> coneRadii(points.size(), fullRadius);
+  for(size_t i = 0; i < radii.size() && i < points.size(); i++) {
+    coneRadii[i] = std::min(2.0f * radii[i] / width, fullRadius);
+  }
+
+  // bucket cones by level, counting first so every buffer is sized once
+  std::vector<uint32_t> levels(points.size());
+  for(ConeLOD& lod : lods) {
+    lod.instanceCount = 0;
+  }
+
+  for(size_t i = 0; i < points.size(); i++) {
+    levels[i] = GetLODIndex(coneRadii[i]);
+    lods[levels[i]].instanceCount++;
+  }
+
+  for(ConeLOD& lod : lods) {
+    GenerateInstanceBuffer(lod, lod.instanceCount);
+    lod.instanceCount = 0;
+  }
+
+  // write instances straight into the mapped buffers, no staging required,
+  // once no render is still drawing from them
+  computePipeline->CompletePending();
+  uint32_t layer = 0;
+  for(size_t i = 0; i < points.size(); i++) {
+    while(layer + 1 < layerStarts.size() && i >= layerStarts[layer + 1]) {
+      layer++;
     }
-    // TODO: separate buffer creation from expansion
 
-    colorBufferSize = BUFFER_INCREMENT * (len / BUFFER_INCREMENT + 1);
+    ConeLOD& lod = lods[levels[i]];
+    if(layers > 1) {
+      lod.instanceLayers[lod.instanceCount] = layer;
+    }
+    lod.instances[lod.instanceCount++] = {points[i], coneRadii[i], static_cast<uint32_t>(i - layerStarts[layer])};
+  }
+}
 
-    computePipeline->CreateBuffer(
-        VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-        &colorBuffer,
-        &colorMemory,
-        colorBufferSize*sizeof(glm::vec3));
 
-    std::vector<glm::vec3> colorVec(colorBufferSize);
+std::vector<DrawBatch> GPUVoronoi::GetBatches() {
+  std::vector<DrawBatch> batches;
+  batches.reserve(lods.size());
 
-    for(uint32_t i = 0; i < colorBufferSize; i++) {
-      // TODO: could be done quickly with mapping
-      colorVec[i] = EncodeColor(i);
+  for(const ConeLOD& lod : lods) {
+    if(layers > 1) {
+      batches.push_back({{lod.coneBuffer, lod.instanceBuffer, lod.layerBuffer}, lod.coneBufferSize, lod.instanceCount});
+    }
+    else {
+      batches.push_back({{lod.coneBuffer, lod.instanceBuffer}, lod.coneBufferSize, lod.instanceCount});
     }
+  }
+
+  return batches;
+}
+
 
-     computePipeline->CopyData(colorVec.data(), colorBufferSize * sizeof(glm::vec3), colorBuffer, &colorMemory);
+bool GPUVoronoi::IsCovered(const LabelMap& map, const LabelRegion& region) {
+  for(int y = region.y; y < region.y + region.height; y++) {
+    for(int x = region.x; x < region.x + region.width; x++) {
+      if(map.At(x, y) == LABEL_EMPTY) {
+        return false;
+      }
+    }
   }
+
+  return true;
 }
 
 
-void GPUVoronoi::DrawCones(std::vector<glm::vec2> points) {
-  GenerateColorBuffer(points.size());
+void GPUVoronoi::DrawCones(const std::vector<glm::vec2>& points) {
+  UploadPoints(points, {});
+  computePipeline->RenderImage(GetBatches());  
+}
 
-  // write color and position data to buffers
-  // draw instances
 
-  computePipeline->CreateBuffer(
-      VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-      &positionBuffer,
-      &posMemory,
-      points.size()*sizeof(glm::vec2));
+cimg_library::CImg<uint32_t> GPUVoronoi::GetImage(const std::vector<glm::vec2>& points) {
+  UploadPoints(points, {});
 
-  computePipeline->CopyData(points.data(), points.size() * sizeof(glm::vec2), positionBuffer, &posMemory);
+  // render and readback are submitted together
+  return computePipeline->RenderAndCopyImage(GetBatches());
+}
 
-  std::vector<VkBuffer> buffers = {coneBuffer, positionBuffer, colorBuffer};
-  computePipeline->RenderImage(buffers, coneBufferSize, points.size());  
 
-  // TODO: re bind rather than recreate
-  VkDevice device = computePipeline->GetDevice();
-  vkDestroyBuffer(device, positionBuffer, nullptr);
-  vkFreeMemory(device, posMemory, nullptr);
+LabelMap GPUVoronoi::GetLabelMap(const std::vector<glm::vec2>& points) {
+  return GetLabelMap(points, {});
 }
 
 
-cimg_library::CImg<unsigned char> GPUVoronoi::GetImage(const std::vector<glm::vec2>& points) {
-  DrawCones(points);
-  return GetImage();
+LabelMap GPUVoronoi::GetLabelMap(const std::vector<glm::vec2>& points, const std::vector<float>& radii) {
+  UploadPoints(points, radii);
+
+  // view into the mapped readback image, valid until the next render
+  LabelMap map = computePipeline->RenderAndMapImage(GetBatches());
+
+  if(!radii.empty() && !IsCovered(map, {0, 0, width, height})) {
+    // bounded cones left a gap, redraw this frame with every cone at full reach
+    UploadPoints(points, {});
+    map = computePipeline->RenderAndMapImage(GetBatches());
+  }
+
+  return map;
+}
+
+
+std::vector<LabelMap> GPUVoronoi::GetLabelMaps(const std::vector<std::vector<glm::vec2>>& pointSets) {
+  if(pointSets.size() > layers) {
+    throw std::runtime_error("more point sets than framebuffer layers!");
+  }
+
+  // every set goes into one upload at full reach, each drawn into its own
+  // layer; one render and one readback cover the lot
+  std::vector<glm::vec2> points;
+  std::vector<uint32_t> layerStarts;
+  for(const std::vector<glm::vec2>& pointSet : pointSets) {
+    layerStarts.push_back(points.size());
+    points.insert(points.end(), pointSet.begin(), pointSet.end());
+  }
+
+  UploadInstances(points, {}, layerStarts);
+
+  // views into the mapped readback buffer, valid until the next render
+  std::vector<LabelMap> maps = computePipeline->RenderAndMapLayers(GetBatches());
+  maps.resize(pointSets.size());
+  return maps;
+}
+
+
+LabelMap GPUVoronoi::StreamLabelMap(const std::vector<glm::vec2>& points, const std::vector<float>& radii, const LabelBandCallback& band) {
+  UploadPoints(points, radii);
+
+  // bands are handed on until one shows a gap left by bounded cones, the
+  // rest of the frame then comes from a redraw with every cone at full reach
+  size_t forwarded = 0;
+  bool covered = true;
+  LabelMap map = computePipeline->RenderAndStreamImage(GetBatches(),
+      [&](const LabelMap& view, const LabelRegion& region) {
+        covered = covered && (radii.empty() || IsCovered(view, region));
+        if(covered) {
+          band(view, region);
+          forwarded++;
+        }
+      });
+
+  if(!covered) {
+    UploadPoints(points, {});
+
+    size_t skipped = 0;
+    map = computePipeline->RenderAndStreamImage(GetBatches(),
+        [&](const LabelMap& view, const LabelRegion& region) {
+          if(skipped++ >= forwarded) {
+            band(view, region);
+          }
+        });
+  }
+
+  return map;
+}
+
+
+void GPUVoronoi::SetDensity(const cimg_library::CImg<unsigned char>& img) {
+  std::vector<float> density(static_cast<size_t>(width) * height);
+
+  for(int y = 0; y < height; y++) {
+    for(int x = 0; x < width; x++) {
+      density[static_cast<size_t>(y) * width + x] = Density(img(x, y));
+    }
+  }
+
+  computePipeline->SetDensity(density);
 }
 
 
-cimg_library::CImg<unsigned char> GPUVoronoi::GetImage() {
+std::vector<VoronoiCell> GPUVoronoi::ReduceMoments(uint32_t cells, double* coveredArea) {
+  DeviceFuture<const float*> reduction = computePipeline->RenderAndReduceMomentsAsync(GetBatches(), cells);
+
+  // the cells are allocated and cleared while the device reduces
+  std::vector<VoronoiCell> voronoi(cells);
+  *coveredArea = 0.0;
+
+  const float* moments = reduction.Get();
+
+  for(uint32_t i = 0; i < cells; i++, moments += MOMENT_COUNT) {
+    voronoi[i].area = moments[0];
+    voronoi[i].m00 = moments[1];
+    voronoi[i].m10 = moments[2];
+    voronoi[i].m01 = moments[3];
+    voronoi[i].m11 = moments[4];
+    voronoi[i].m20 = moments[5];
+    voronoi[i].m02 = moments[6];
+
+    *coveredArea += moments[0];
+  }
+
+  return voronoi;
+}
+
+
+std::vector<VoronoiCell> GPUVoronoi::GetCells(const std::vector<glm::vec2>& points, const std::vector<float>& radii) {
+  UploadPoints(points, radii);
+
+  double coveredArea;
+  std::vector<VoronoiCell> voronoi = ReduceMoments(points.size(), &coveredArea);
+
+  // areas are whole pixel counts, any shortfall means bounded cones left a gap
+  if(!radii.empty() && coveredArea < static_cast<double>(width) * height) {
+    UploadPoints(points, {});
+    voronoi = ReduceMoments(points.size(), &coveredArea);
+  }
+
+  // only centroids and orientations are left to the host
+  FinalizeVoronoiCells(voronoi, width, height);
+  return voronoi;
+}
+
+
+bool GPUVoronoi::AcquireSurface() {
+  SurfacePool& pool = GetSurfacePool();
+  std::lock_guard<std::mutex> lock(pool.mutex);
+
+  auto entry = pool.idle.find(surfaceKey);
+  if(entry == pool.idle.end() || entry->second.empty()) {
+    return false;
+  }
+
+  // a surface is tied to its device; reuse the one on the least loaded
+  // device, and only if no other device has a freer queue, so pooling
+  // never keeps solvers off a device a new one would be given
+  const uint32_t least = VulkanContext::LeastActiveOverall();
+  auto chosen = entry->second.end();
+  for(auto surface = entry->second.begin(); surface != entry->second.end(); surface++) {
+    if(surface->vulkan->QueueLoad() == least) {
+      chosen = surface;
+      break;
+    }
+  }
+
+  if(chosen == entry->second.end()) {
+    return false;
+  }
+
+  // instance buffers and moments carry over, both are rewritten before use
+  computePipeline = chosen->vulkan;
+  lods = std::move(chosen->lods);
+  entry->second.erase(chosen);
+  computePipeline->AcquireQueue();
+
+  // timings left over from the previous solver are not ours
+  computePipeline->TakeTimings();
+
+  return true;
+}
+
+
+void GPUVoronoi::ReleaseSurface() {
+  if(!keepSurface) {
+    VoronoiSurface surface = {computePipeline, std::move(lods)};
+    DestroySurface(surface);
+    computePipeline = nullptr;
+    return;
+  }
+
+  // an idle surface holds no queue, solvers still running spread over them
+  computePipeline->ReleaseQueue();
+
+  SurfacePool& pool = GetSurfacePool();
+  std::lock_guard<std::mutex> lock(pool.mutex);
+
+  pool.idle[surfaceKey].push_back({computePipeline, std::move(lods)});
+  computePipeline = nullptr;
+}
+
+
+cimg_library::CImg<uint32_t> GPUVoronoi::GetImage() {
   return computePipeline->CopyImage(); 
 }
+
+
+void GPUVoronoi::FreeResident() {
+  if(residentCapacity == 0) {
+    return;
+  }
+
+  for(int i = 0; i < 2; i++) {
+    residentPoints[i].Reset();
+  }
+
+  counterBuffer.Reset();
+  counterReadback.Reset();
+  paramBuffer.Reset();
+
+  residentCapacity = 0;
+}
+
+
+void GPUVoronoi::BeginResident(const std::vector<glm::vec2>& points, uint32_t capacity) {
+  if(!SupportsResident()) {
+    throw std::runtime_error("device resident iterations require moment reduction!");
+  }
+
+  // nothing in flight may still use the buffers being replaced
+  computePipeline->CompletePending();
+  FreeResident();
+  residentCapacity = std::max<uint32_t>(capacity, std::max<size_t>(points.size(), 1));
+
+  const VkDeviceSize pointSize = static_cast<VkDeviceSize>(residentCapacity) * sizeof(ConeInstance);
+
+  residentPoints[0] = computePipeline->CreateBuffer(
+      VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+      pointSize);
+
+  residentPoints[1] = computePipeline->CreateBuffer(
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+      pointSize);
+
+  counterBuffer = computePipeline->CreateBuffer(
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+      RESIDENT_COUNTERS * sizeof(uint32_t));
+
+  counterReadback = computePipeline->CreateHostBuffer(VK_BUFFER_USAGE_TRANSFER_DST_BIT, RESIDENT_COUNTERS * sizeof(uint32_t));
+  counters = static_cast<const uint32_t*>(counterReadback.Mapped());
+
+  paramBuffer = computePipeline->CreateBuffer(
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+      sizeof(ResidentParams));
+  residentParams = static_cast<ResidentParams*>(paramBuffer.Mapped());
+
+  // moments for every cell the points could grow to, so the moment buffer
+  // is never replaced under the recorded passes
+  computePipeline->ReserveMoments(residentCapacity);
+
+  if(lbg.setLayout == VK_NULL_HANDLE) {
+    lbg = computePipeline->CreateComputePipeline({"lbgDecide.comp.spv", "lbgFinalize.comp.spv"}, 5, 1, 0);
+    lbgCommand = computePipeline->AllocateCommandBuffer();
+  }
+  computePipeline->UpdateComputeSet(lbg, 0, {computePipeline->GetMomentBuffer(), paramBuffer, counterBuffer, residentPoints[1], computePipeline->GetIndirectBuffer()});
+
+  // the only upload, every later point set is produced on the device; the
+  // cells are not known yet, so the first cones reach across the image
+  std::vector<ConeInstance> instances;
+  instances.reserve(points.size());
+  for(size_t i = 0; i < points.size(); i++) {
+    instances.push_back({points[i], fullRadius, static_cast<uint32_t>(i)});
+  }
+
+  if(!instances.empty()) {
+    computePipeline->CopyData(instances.data(), instances.size() * sizeof(ConeInstance), residentPoints[0]);
+  }
+
+  uint32_t initial[RESIDENT_COUNTERS] = { static_cast<uint32_t>(points.size()), 0, 0, static_cast<uint32_t>(points.size()), 0 };
+  computePipeline->CopyData(initial, sizeof(initial), counterBuffer);
+
+  residentSeed = 0;
+  residentCount = points.size();
+  residentReach = fullRadius;
+  residentFirst = true;
+  RecordResident();
+}
+
+
+void GPUVoronoi::RecordResident() {
+  VkCommandBufferBeginInfo cmdBufInfo = vks::initializers::commandBufferBeginInfo();
+  VK_CHECK_RESULT(vkResetCommandBuffer(lbgCommand, 0))
+  VK_CHECK_RESULT(vkBeginCommandBuffer(lbgCommand, &cmdBufInfo))
+
+  // everything but the count starts from zero, the moment pass already made
+  // its writes visible to compute reads
+  vkCmdFillBuffer(lbgCommand, counterBuffer, sizeof(uint32_t), (RESIDENT_COUNTERS - 1) * sizeof(uint32_t), 0);
+
+  VkMemoryBarrier barrier = vks::initializers::memoryBarrier();
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+  vkCmdPipelineBarrier(lbgCommand, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+  // keep, split or remove every cell and compact the survivors
+  vkCmdBindDescriptorSets(lbgCommand, VK_PIPELINE_BIND_POINT_COMPUTE, lbg.layout, 0, 1, &lbg.sets[0], 0, nullptr);
+  vkCmdBindPipeline(lbgCommand, VK_PIPELINE_BIND_POINT_COMPUTE, lbg.pipelines[0]);
+  vkCmdDispatch(lbgCommand, (residentCapacity + 63) / 64, 1, 1);
+
+  barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  vkCmdPipelineBarrier(lbgCommand, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+  // publish the new count to the counters and the indirect draw
+  vkCmdBindPipeline(lbgCommand, VK_PIPELINE_BIND_POINT_COMPUTE, lbg.pipelines[1]);
+  vkCmdDispatch(lbgCommand, 1, 1, 1);
+
+  barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+  vkCmdPipelineBarrier(lbgCommand, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+  VkBufferCopy pointCopy = {};
+  pointCopy.size = static_cast<VkDeviceSize>(residentCapacity) * sizeof(ConeInstance);
+  vkCmdCopyBuffer(lbgCommand, residentPoints[1], residentPoints[0], 1, &pointCopy);
+
+  VkBufferCopy counterCopy = {};
+  counterCopy.size = RESIDENT_COUNTERS * sizeof(uint32_t);
+  vkCmdCopyBuffer(lbgCommand, counterBuffer, counterReadback, 1, &counterCopy);
+
+  // the next iteration draws the new points with the new count, and the
+  // host reads the counters once the fence signals
+  barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_HOST_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+  vkCmdPipelineBarrier(lbgCommand,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+      VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_HOST_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+      0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+  VK_CHECK_RESULT(vkEndCommandBuffer(lbgCommand))
+}
+
+
+void GPUVoronoi::IterateResident(const ResidentBounds& bounds, uint32_t* count, uint32_t* changes) {
+  computePipeline->CompletePending();
+  *residentParams = {bounds.lower, bounds.upper, bounds.jitter, bounds.margin, fullRadius, width, height, residentSeed++, residentCapacity};
+
+  // lbgDecide.comp sizes every cone from its cell, and reports the largest;
+  // all are drawn from the level tessellated for that one, so no cone is
+  // coarser than the host path would draw it. After the first iteration the
+  // count is written on the device
+  const ConeLOD& lod = lods[residentReach > 0.0f ? GetLODIndex(residentReach) : 0];
+  DrawBatch batch = {{lod.coneBuffer, residentPoints[0]}, lod.coneBufferSize, residentCount, !residentFirst};
+  residentFirst = false;
+
+  computePipeline->RenderAndReduceMoments({batch}, lbgCommand);
+
+  computePipeline->InvalidateHostBuffer(counterReadback);
+
+  // requested rather than stored, so overflowing the capacity is visible
+  *count = counters[3];
+  *changes = counters[2];
+  residentCount = counters[0];
+  memcpy(&residentReach, &counters[4], sizeof(float));
+}
+
+
+std::vector<glm::vec2> GPUVoronoi::ReadPoints() {
+  const uint32_t count = residentCount;
+  std::vector<glm::vec2> points;
+  if(count == 0) {
+    return points;
+  }
+
+  DeviceBuffer hostBuffer = computePipeline->CreateHostBuffer(VK_BUFFER_USAGE_TRANSFER_DST_BIT, count * sizeof(ConeInstance));
+
+  VkCommandBuffer cmd = computePipeline->BeginCommands();
+
+  VkBufferCopy copyRegion = {};
+  copyRegion.size = count * sizeof(ConeInstance);
+  vkCmdCopyBuffer(cmd, residentPoints[0], hostBuffer, 1, &copyRegion);
+
+  VkMemoryBarrier barrier = vks::initializers::memoryBarrier();
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+  vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+  computePipeline->SubmitCommands();
+
+  computePipeline->InvalidateHostBuffer(hostBuffer);
+
+  const ConeInstance* instances = static_cast<const ConeInstance*>(hostBuffer.Mapped());
+  points.reserve(count);
+  for(uint32_t i = 0; i < count; i++) {
+    points.push_back(instances[i].position);
+  }
+
+  return points;
+}
@@ -56,272 +56,385 @@ void insertImageMemoryBarrier(
 // Headless Functions
 //////////
 
-uint32_t HeadlessVulkan::GetMemoryTypeIndex(uint32_t typeBits, VkMemoryPropertyFlags properties) {
+uint32_t HeadlessVulkan::FormatSize(VkFormat format) {
+  switch (format) {
+    case VK_FORMAT_R16_UINT:
+      return 2;
+    case VK_FORMAT_R32_UINT:
+    case VK_FORMAT_R8G8B8A8_UNORM:
+      return 4;
+    default:
+      throw std::runtime_error("unsupported colour attachment format!");
+  }
+}
+
+bool HeadlessVulkan::FindMemoryType(uint32_t typeBits, VkMemoryPropertyFlags properties, uint32_t* index) {
   VkPhysicalDeviceMemoryProperties deviceMemoryProperties;
   vkGetPhysicalDeviceMemoryProperties(physicalDevice, &deviceMemoryProperties);
 
   for (uint32_t i = 0; i < deviceMemoryProperties.memoryTypeCount; i++) {
     if ((typeBits & 1) == 1) {
       if ((deviceMemoryProperties.memoryTypes[i].propertyFlags & properties) == properties) {
-        return i;
+        *index = i;
+        return true;
       }
     }
     typeBits >>= 1;
   }
-  return 0;
+  return false;
 }
 
-void HeadlessVulkan::CopyData(void* data, uint32_t bufferSize, VkBuffer& outputBuffer, VkDeviceMemory *outputmemory) {
-  VkBuffer stagingBuffer;
-  VkDeviceMemory stagingMemory;
-
-  // Command buffer for copy commands (reused)
-  VkCommandBufferAllocateInfo cmdBufAllocateInfo = vks::initializers::commandBufferAllocateInfo(commandPool, VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1);
-
-  VkCommandBuffer copyCmd;
-  VK_CHECK_RESULT(vkAllocateCommandBuffers(device, &cmdBufAllocateInfo, &copyCmd))
-
-  VkCommandBufferBeginInfo cmdBufInfo = vks::initializers::commandBufferBeginInfo();
+uint32_t HeadlessVulkan::GetMemoryTypeIndex(uint32_t typeBits, VkMemoryPropertyFlags properties) {
+  uint32_t index = 0;
+  FindMemoryType(typeBits, properties, &index);
+  return index;
+}
 
-  // Create staging buffer
-  CreateBuffer(
+void HeadlessVulkan::CopyData(const void* data, VkDeviceSize bufferSize, VkBuffer outputBuffer) {
+  // staging is sub-allocated and released on return
+  DeviceBuffer staging = CreateBuffer(
       VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
       VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-      &stagingBuffer,
-      &stagingMemory,
       bufferSize,
       data);
 
-  VK_CHECK_RESULT(vkBeginCommandBuffer(copyCmd, &cmdBufInfo))
-    VkBufferCopy copyRegion = {};
+  uint32_t slot = AcquireCommandBuffer(&DeviceTimings::upload);
+  VkCommandBuffer copyCmd = commandBuffers[slot];
+
+  VkBufferCopy copyRegion = {};
   copyRegion.size = bufferSize;
 
-  vkCmdCopyBuffer(copyCmd, stagingBuffer, outputBuffer, 1, &copyRegion);
+  vkCmdCopyBuffer(copyCmd, staging, outputBuffer, 1, &copyRegion);
+  EndTimestamp(copyCmd);
   VK_CHECK_RESULT(vkEndCommandBuffer(copyCmd))
 
-  SubmitWork(copyCmd, queue);
-
-  // Destroy staging buffer
-  vkDestroyBuffer(device, stagingBuffer, nullptr);
-  vkFreeMemory(device, stagingMemory, nullptr);
+  SubmitWork({ copyCmd }, fences[slot]);
 }
 
-VkResult HeadlessVulkan::CreateBuffer(VkBufferUsageFlags usageFlags,
+DeviceBuffer HeadlessVulkan::CreateBuffer(VkBufferUsageFlags usageFlags,
     VkMemoryPropertyFlags memoryPropertyFlags,
-    VkBuffer *buffer,
-    VkDeviceMemory *memory,
-    VkDeviceSize size, void *data) {
+    VkDeviceSize size, const void* data) {
 
   // Create the buffer handle
+  VkBuffer buffer;
   VkBufferCreateInfo bufferCreateInfo = vks::initializers::bufferCreateInfo(usageFlags, size);
   bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-  VK_CHECK_RESULT(vkCreateBuffer(device, &bufferCreateInfo, nullptr, buffer))
+  VK_CHECK_RESULT(vkCreateBuffer(device, &bufferCreateInfo, nullptr, &buffer))
 
-  // Create the memory backing up the buffer handle
+  // Back it with a range of one of the context's memory blocks
   VkMemoryRequirements memReqs;
-  VkMemoryAllocateInfo memAlloc = vks::initializers::memoryAllocateInfo();
-  vkGetBufferMemoryRequirements(device, *buffer, &memReqs);
-  memAlloc.allocationSize = memReqs.size;
-  memAlloc.memoryTypeIndex = GetMemoryTypeIndex(memReqs.memoryTypeBits, memoryPropertyFlags);
-  VK_CHECK_RESULT(vkAllocateMemory(device, &memAlloc, nullptr, memory))
+  vkGetBufferMemoryRequirements(device, buffer, &memReqs);
+  MemoryAllocation allocation = context->allocator.Allocate(memReqs, GetMemoryTypeIndex(memReqs.memoryTypeBits, memoryPropertyFlags), true);
+  VK_CHECK_RESULT(vkBindBufferMemory(device, buffer, allocation.block->memory, allocation.offset))
 
   if (data != nullptr) {
-    void *mapped;
-    VK_CHECK_RESULT(vkMapMemory(device, *memory, 0, size, 0, &mapped))
-    memcpy(mapped, data, size);
-    vkUnmapMemory(device, *memory);
+    memcpy(allocation.mapped, data, size);
+    context->allocator.Flush(allocation);
   }
 
-  VK_CHECK_RESULT(vkBindBufferMemory(device, *buffer, *memory, 0))
+  return DeviceBuffer(context, buffer, allocation);
+}
+
+
+void HeadlessVulkan::AttachContext() {
+  context = VulkanContext::Acquire(&queueIndex);
+  queueHeld = true;
+  physicalDevice = context->physicalDevice;
+  device = context->device;
+  queueFamilyIndex = context->queueFamilyIndex;
+  pipelineCache = context->pipelineCache;
+  floatAtomics = context->floatAtomics;
+}
+
+
+void HeadlessVulkan::CreateCommandPool() {
+  VkCommandPoolCreateInfo cmdPoolInfo = {};
+  cmdPoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+  cmdPoolInfo.queueFamilyIndex = queueFamilyIndex;
+  cmdPoolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+  VK_CHECK_RESULT(vkCreateCommandPool(device, &cmdPoolInfo, nullptr, &commandPool))
+}
+
 
-  return VK_SUCCESS;
+void HeadlessVulkan::CreateCommandBuffers() {
+  // buffers for the pre-recorded moment clear and copy, plus a small ring of
+  // resettable buffers for transfers, each paired with its own fence; every
+  // tile brings its own render, readback and reduction
+  VkCommandBufferAllocateInfo cmdBufAllocateInfo =
+    vks::initializers::commandBufferAllocateInfo(commandPool,
+        VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1);
+  VK_CHECK_RESULT(vkAllocateCommandBuffers(device, &cmdBufAllocateInfo, &momentClearCommand))
+  VK_CHECK_RESULT(vkAllocateCommandBuffers(device, &cmdBufAllocateInfo, &momentCopyCommand))
+
+  commandBuffers.resize(COMMAND_BUFFER_COUNT);
+  cmdBufAllocateInfo.commandBufferCount = COMMAND_BUFFER_COUNT;
+  VK_CHECK_RESULT(vkAllocateCommandBuffers(device, &cmdBufAllocateInfo, commandBuffers.data()))
+
+  // fences start signalled so the first acquire of each slot does not block
+  VkFenceCreateInfo fenceInfo = vks::initializers::fenceCreateInfo(VK_FENCE_CREATE_SIGNALED_BIT);
+  fences.resize(COMMAND_BUFFER_COUNT);
+  for (VkFence& fence : fences) {
+    VK_CHECK_RESULT(vkCreateFence(device, &fenceInfo, nullptr, &fence))
+  }
+  VK_CHECK_RESULT(vkCreateFence(device, &fenceInfo, nullptr, &renderFence))
+
+  // storage as well, device resident passes write their own instance counts
+  indirectBuffer = CreateBuffer(
+      VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+      MAX_DRAW_BATCHES * sizeof(VkDrawIndirectCommand));
+  indirectCommands = static_cast<VkDrawIndirectCommand*>(indirectBuffer.Mapped());
+  memset(indirectCommands, 0, MAX_DRAW_BATCHES * sizeof(VkDrawIndirectCommand));
 }
 
 
-void HeadlessVulkan::CreateInstance() {
-  const char* validationLayers[] = { "VK_LAYER_LUNARG_standard_validation" };
-  uint32_t layerCount = 0;
+uint32_t HeadlessVulkan::AcquireCommandBuffer(double DeviceTimings::* pass) {
+  // round robin over the pool, a slot is free again once its fence signals
+  uint32_t slot = nextCommandBuffer;
+  nextCommandBuffer = (nextCommandBuffer + 1) % COMMAND_BUFFER_COUNT;
 
-  // Check if layers are available
-  uint32_t instanceLayerCount;
-  vkEnumerateInstanceLayerProperties(&instanceLayerCount, nullptr);
-  std::vector<VkLayerProperties> instanceLayers(instanceLayerCount);
-  vkEnumerateInstanceLayerProperties(&instanceLayerCount, instanceLayers.data());
+  CompleteWork(fences[slot]);
+  VK_CHECK_RESULT(vkResetCommandBuffer(commandBuffers[slot], 0))
 
-  VkApplicationInfo appInfo = {};
-  appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
-  // TODO: this should be configurable?
-  appInfo.pApplicationName = "Vulkan headless example";
-  appInfo.pEngineName = "VulkanExample";
-  appInfo.apiVersion = VK_API_VERSION_1_0;
+  VkCommandBufferBeginInfo cmdBufInfo = vks::initializers::commandBufferBeginInfo();
+  cmdBufInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  VK_CHECK_RESULT(vkBeginCommandBuffer(commandBuffers[slot], &cmdBufInfo))
+  BeginTimestamp(commandBuffers[slot], pass);
 
-  VkInstanceCreateInfo instanceCreateInfo = {};
-  instanceCreateInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
-  instanceCreateInfo.pApplicationInfo = &appInfo;
+  return slot;
+}
 
-  bool layersAvailable = true;
-  bool layerAvailable;
-  for (auto layerName : validationLayers) {
-    layerAvailable = false;
-    for (auto instanceLayer : instanceLayers) {
-      if (strcmp(instanceLayer.layerName, layerName) == 0) {
-        layerAvailable = true;
-        break;
-      }
-    }
 
-    // If any layer is missing, configuration can't be used
-    if (!layerAvailable) {
-      layersAvailable = false;
-      break;
+void HeadlessVulkan::CreateQueryPool() {
+  // queues without timestamp support leave the pool out, and every pass
+  // reports no device time
+  uint32_t queueFamilyCount;
+  vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+  std::vector<VkQueueFamilyProperties> queueFamilyProperties(queueFamilyCount);
+  vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilyProperties.data());
+
+  const uint32_t validBits = queueFamilyProperties[queueFamilyIndex].timestampValidBits;
+  if (validBits == 0) {
+    return;
+  }
+
+  VkPhysicalDeviceProperties deviceProperties;
+  vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+  timestampPeriod = deviceProperties.limits.timestampPeriod;
+  timestampMask = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+
+  // the transfer ring, the moment clear and copy, and every tile's passes
+  std::vector<VkCommandBuffer> cmdBuffers = commandBuffers;
+  cmdBuffers.push_back(momentClearCommand);
+  cmdBuffers.push_back(momentCopyCommand);
+  for (const RenderTile& tile : tiles) {
+    cmdBuffers.insert(cmdBuffers.end(), { tile.render, tile.readback, tile.moments });
+    for (const ReadbackBand& band : tile.bands) {
+      cmdBuffers.push_back(band.copy);
     }
   }
 
-  if (layersAvailable) {
-    instanceCreateInfo.ppEnabledLayerNames = validationLayers;
-    const char *validationExt = VK_EXT_DEBUG_REPORT_EXTENSION_NAME;
-    instanceCreateInfo.enabledLayerCount = layerCount;
-    instanceCreateInfo.enabledExtensionCount = 1;
-    instanceCreateInfo.ppEnabledExtensionNames = &validationExt;
+  for (VkCommandBuffer cmdBuffer : cmdBuffers) {
+    timedCommands[cmdBuffer].query = 2 * static_cast<uint32_t>(timedCommands.size() - 1);
   }
 
-  VK_CHECK_RESULT(vkCreateInstance(&instanceCreateInfo, nullptr, &instance))
+  VkQueryPoolCreateInfo queryPoolInfo = {};
+  queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+  queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+  queryPoolInfo.queryCount = 2 * static_cast<uint32_t>(timedCommands.size());
+  VK_CHECK_RESULT(vkCreateQueryPool(device, &queryPoolInfo, nullptr, &queryPool))
+}
 
-    if (layersAvailable) {
-      VkDebugReportCallbackCreateInfoEXT debugReportCreateInfo = {};
-      debugReportCreateInfo.sType = VK_STRUCTURE_TYPE_DEBUG_REPORT_CALLBACK_CREATE_INFO_EXT;
-      debugReportCreateInfo.flags = VK_DEBUG_REPORT_ERROR_BIT_EXT | VK_DEBUG_REPORT_WARNING_BIT_EXT;
-      debugReportCreateInfo.pfnCallback = (PFN_vkDebugReportCallbackEXT)debugMessageCallback;
 
-      // We have to explicitly load this function.
-      auto vkCreateDebugReportCallbackEXT = reinterpret_cast<PFN_vkCreateDebugReportCallbackEXT>(vkGetInstanceProcAddr(instance, "vkCreateDebugReportCallbackEXT"));
-      assert(vkCreateDebugReportCallbackEXT);
-      VK_CHECK_RESULT(vkCreateDebugReportCallbackEXT(instance, &debugReportCreateInfo, nullptr, &debugReportCallback))
-    }
+void HeadlessVulkan::BeginTimestamp(VkCommandBuffer cmdBuffer, double DeviceTimings::* pass) {
+  // outside any render pass, the pair is reset every time it is recorded
+  auto timed = timedCommands.find(cmdBuffer);
+  if (timed == timedCommands.end()) {
+    return;
+  }
+
+  timed->second.pass = pass;
+  vkCmdResetQueryPool(cmdBuffer, queryPool, timed->second.query, 2);
+  vkCmdWriteTimestamp(cmdBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool, timed->second.query);
+}
+
+
+void HeadlessVulkan::EndTimestamp(VkCommandBuffer cmdBuffer) {
+  auto timed = timedCommands.find(cmdBuffer);
+  if (timed == timedCommands.end()) {
+    return;
+  }
+
+  vkCmdWriteTimestamp(cmdBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, timed->second.query + 1);
 }
 
 
-void HeadlessVulkan::CreateDevice() {
-  uint32_t deviceCount = 0;
+void HeadlessVulkan::CollectTimestamps(const std::vector<VkCommandBuffer>& cmdBuffers) {
+  // the submission has finished, so its queries are available
+  double elapsed = 0.0;
+  for (VkCommandBuffer cmdBuffer : cmdBuffers) {
+    auto timed = timedCommands.find(cmdBuffer);
+    if (timed == timedCommands.end() || timed->second.pass == nullptr) {
+      continue;
+    }
 
-  VK_CHECK_RESULT(vkEnumeratePhysicalDevices(instance, &deviceCount, nullptr))
-    std::vector<VkPhysicalDevice> physicalDevices(deviceCount);
+    uint64_t stamps[2];
+    VkResult result = vkGetQueryPoolResults(device, queryPool, timed->second.query, 2, sizeof(stamps), stamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+    if (result == VK_SUCCESS) {
+      const uint64_t ticks = (stamps[1] - stamps[0]) & timestampMask;
+      timings.*(timed->second.pass) += ticks * timestampPeriod / 1e6;
+      elapsed += ticks * timestampPeriod / 1e6;
+    }
+  }
 
-  VK_CHECK_RESULT(vkEnumeratePhysicalDevices(instance, &deviceCount, physicalDevices.data()))
+  // the queue's share of device time, for the context's throughput report
+  if (elapsed > 0.0) {
+    context->AddDeviceTime(queueIndex, elapsed);
+  }
+}
 
-    std::cout << physicalDevices.size() << std::endl;
 
-  // TODO: choose best device
-  physicalDevice = physicalDevices[0];
+DeviceTimings HeadlessVulkan::TakeTimings() {
+  // totals since the previous call
+  DeviceTimings taken = timings;
+  timings = DeviceTimings();
+  return taken;
+}
 
+void HeadlessVulkan::CreateTiles() {
+  // the framebuffer is bounded by the device's limits and MAX_TILE_SIZE, so
+  // device memory stays fixed however large the image
   VkPhysicalDeviceProperties deviceProperties;
   vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
 
-  // Request a single graphics queue
-  const float defaultQueuePriority(0.0f);
-  VkDeviceQueueCreateInfo queueCreateInfo = {};
-  uint32_t queueFamilyCount;
-  vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
-  std::vector<VkQueueFamilyProperties> queueFamilyProperties(queueFamilyCount);
-  vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilyProperties.data());
+  const VkPhysicalDeviceLimits& limits = deviceProperties.limits;
+  const uint32_t maxWidth = std::min({ limits.maxImageDimension2D, limits.maxFramebufferWidth, static_cast<uint32_t>(MAX_TILE_SIZE) });
+  const uint32_t maxHeight = std::min({ limits.maxImageDimension2D, limits.maxFramebufferHeight, static_cast<uint32_t>(MAX_TILE_SIZE) });
 
-  for (uint32_t i = 0; i < static_cast<uint32_t>(queueFamilyProperties.size()); i++) {
-    if (queueFamilyProperties[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) {
-      queueFamilyIndex = i;
-      queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-      queueCreateInfo.queueFamilyIndex = i;
-      queueCreateInfo.queueCount = 1;
-      queueCreateInfo.pQueuePriorities = &defaultQueuePriority;
-      break;
-    }
+  if (layers > 1 && !context->layerOutput) {
+    throw std::runtime_error("layered rendering requires VK_EXT_shader_viewport_index_layer!");
+  }
+  if (layers > std::min(limits.maxImageArrayLayers, limits.maxFramebufferLayers)) {
+    throw std::runtime_error("too many layers for the framebuffer!");
   }
 
-  VkDeviceCreateInfo deviceCreateInfo = {};
-  deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-  deviceCreateInfo.queueCreateInfoCount = 1;
-  deviceCreateInfo.pQueueCreateInfos = &queueCreateInfo;
+  // tiles split the image evenly rather than leaving a thin remainder
+  const uint32_t columns = (width + maxWidth - 1) / maxWidth;
+  const uint32_t rows = (height + maxHeight - 1) / maxHeight;
+  tileWidth = (width + columns - 1) / columns;
+  tileHeight = (height + rows - 1) / rows;
+
+  VkCommandBufferAllocateInfo cmdBufAllocateInfo =
+    vks::initializers::commandBufferAllocateInfo(commandPool,
+        VK_COMMAND_BUFFER_LEVEL_PRIMARY, 3);
+
+  for (uint32_t row = 0; row < rows; row++) {
+    for (uint32_t column = 0; column < columns; column++) {
+      RenderTile tile;
+      tile.x = column * tileWidth;
+      tile.y = row * tileHeight;
+      tile.width = std::min<uint32_t>(tileWidth, width - tile.x);
+      tile.height = std::min<uint32_t>(tileHeight, height - tile.y);
+
+      VkCommandBuffer cmdBuffers[3];
+      VK_CHECK_RESULT(vkAllocateCommandBuffers(device, &cmdBufAllocateInfo, cmdBuffers))
+      tile.render = cmdBuffers[0];
+      tile.readback = cmdBuffers[1];
+      tile.moments = cmdBuffers[2];
+
+      // fences start signalled like the transfer ring's
+      VkFenceCreateInfo fenceInfo = vks::initializers::fenceCreateInfo(VK_FENCE_CREATE_SIGNALED_BIT);
+      VkCommandBufferAllocateInfo bandAllocateInfo =
+        vks::initializers::commandBufferAllocateInfo(commandPool,
+            VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1);
+
+      for (uint32_t band = 0; band < tile.height; band += READBACK_BAND_ROWS) {
+        ReadbackBand readbackBand;
+        readbackBand.region.x = tile.x;
+        readbackBand.region.y = tile.y + band;
+        readbackBand.region.width = tile.width;
+        readbackBand.region.height = std::min<uint32_t>(READBACK_BAND_ROWS, tile.height - band);
+        VK_CHECK_RESULT(vkAllocateCommandBuffers(device, &bandAllocateInfo, &readbackBand.copy))
+        VK_CHECK_RESULT(vkCreateFence(device, &fenceInfo, nullptr, &readbackBand.fence))
+        tile.bands.push_back(readbackBand);
+      }
+
+      tiles.push_back(tile);
+    }
+  }
 
-  VK_CHECK_RESULT(vkCreateDevice(physicalDevice, &deviceCreateInfo, nullptr, &device))
+  if (tiles.size() > 1) {
+    std::cout << "rendering in " << tiles.size() << " tiles of " << tileWidth << "x" << tileHeight << std::endl;
+  }
 }
 
 
-void HeadlessVulkan::CreateQueue() {
-  // Get a graphics queue
-  vkGetDeviceQueue(device, queueFamilyIndex, 0, &queue);
+std::vector<VkCommandBuffer> HeadlessVulkan::GetTileCommands(VkCommandBuffer RenderTile::* after) {
+  // tiles share the framebuffer, so each is consumed before the next renders
+  std::vector<VkCommandBuffer> cmdBuffers;
+  cmdBuffers.reserve(2 * tiles.size());
+
+  for (const RenderTile& tile : tiles) {
+    cmdBuffers.push_back(tile.render);
+    if (after != nullptr) {
+      cmdBuffers.push_back(tile.*after);
+    }
+  }
+
+  return cmdBuffers;
 }
 
 
-void HeadlessVulkan::CreateCommandPool() {
-  VkCommandPoolCreateInfo cmdPoolInfo = {};
-  cmdPoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-  cmdPoolInfo.queueFamilyIndex = queueFamilyIndex;
-  cmdPoolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
-  VK_CHECK_RESULT(vkCreateCommandPool(device, &cmdPoolInfo, nullptr, &commandPool))
+DeviceImage HeadlessVulkan::CreateImage(const VkImageCreateInfo& imageInfo, VkImageAspectFlags aspect) {
+  VkImage image;
+  VK_CHECK_RESULT(vkCreateImage(device, &imageInfo, nullptr, &image))
+
+  // optimally tiled images come from their own blocks, away from buffers
+  VkMemoryRequirements memReqs;
+  vkGetImageMemoryRequirements(device, image, &memReqs);
+  MemoryAllocation allocation = context->allocator.Allocate(memReqs, GetMemoryTypeIndex(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT), false);
+  VK_CHECK_RESULT(vkBindImageMemory(device, image, allocation.block->memory, allocation.offset))
+
+  VkImageViewCreateInfo imageView = vks::initializers::imageViewCreateInfo();
+  imageView.viewType = imageInfo.arrayLayers > 1 ? VK_IMAGE_VIEW_TYPE_2D_ARRAY : VK_IMAGE_VIEW_TYPE_2D;
+  imageView.format = imageInfo.format;
+  imageView.subresourceRange = {};
+  imageView.subresourceRange.aspectMask = aspect;
+  imageView.subresourceRange.baseMipLevel = 0;
+  imageView.subresourceRange.levelCount = 1;
+  imageView.subresourceRange.baseArrayLayer = 0;
+  imageView.subresourceRange.layerCount = imageInfo.arrayLayers;
+  imageView.image = image;
+
+  VkImageView view;
+  VK_CHECK_RESULT(vkCreateImageView(device, &imageView, nullptr, &view))
+
+  return DeviceImage(context, image, view, allocation);
 }
 
+
 void HeadlessVulkan::CreateFrameBuffer() {
   VkImageCreateInfo image = vks::initializers::imageCreateInfo();
 
   image.imageType = VK_IMAGE_TYPE_2D;
   image.format = colorFormat;
-  image.extent.width = width;
-  image.extent.height = height;
+  image.extent.width = tileWidth;
+  image.extent.height = tileHeight;
   image.extent.depth = 1;
   image.mipLevels = 1;
-  image.arrayLayers = 1;
+  image.arrayLayers = layers;
   image.samples = VK_SAMPLE_COUNT_1_BIT;
   image.tiling = VK_IMAGE_TILING_OPTIMAL;
-  image.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+  image.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
 
-  VkMemoryAllocateInfo memAlloc = vks::initializers::memoryAllocateInfo();
-  VkMemoryRequirements memReqs;
+  colorAttachment = CreateImage(image, VK_IMAGE_ASPECT_COLOR_BIT);
 
-  VK_CHECK_RESULT(vkCreateImage(device, &image, nullptr, &colorAttachment.image))
-    vkGetImageMemoryRequirements(device, colorAttachment.image, &memReqs);
-  memAlloc.allocationSize = memReqs.size;
-  memAlloc.memoryTypeIndex = GetMemoryTypeIndex(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-
-  VK_CHECK_RESULT(vkAllocateMemory(device, &memAlloc, nullptr, &colorAttachment.memory))
-
-    VK_CHECK_RESULT(vkBindImageMemory(device, colorAttachment.image, colorAttachment.memory, 0))
-
-    VkImageViewCreateInfo colorImageView = vks::initializers::imageViewCreateInfo();
-  colorImageView.viewType = VK_IMAGE_VIEW_TYPE_2D;
-  colorImageView.format = colorFormat;
-  colorImageView.subresourceRange = {};
-  colorImageView.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-  colorImageView.subresourceRange.baseMipLevel = 0;
-  colorImageView.subresourceRange.levelCount = 1;
-  colorImageView.subresourceRange.baseArrayLayer = 0;
-  colorImageView.subresourceRange.layerCount = 1;
-  colorImageView.image = colorAttachment.image;
-
-  VK_CHECK_RESULT(vkCreateImageView(device, &colorImageView, nullptr, &colorAttachment.view))
-
-    // Depth stencil attachment
-    image.format = depthFormat;
+  // Depth stencil attachment
+  image.format = depthFormat;
   image.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
 
-  VK_CHECK_RESULT(vkCreateImage(device, &image, nullptr, &depthAttachment.image))
-    vkGetImageMemoryRequirements(device, depthAttachment.image, &memReqs);
-  memAlloc.allocationSize = memReqs.size;
-  memAlloc.memoryTypeIndex = GetMemoryTypeIndex(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-  VK_CHECK_RESULT(vkAllocateMemory(device, &memAlloc, nullptr, &depthAttachment.memory))
-    VK_CHECK_RESULT(vkBindImageMemory(device, depthAttachment.image, depthAttachment.memory, 0))
-
-    VkImageViewCreateInfo depthStencilView = vks::initializers::imageViewCreateInfo();
-  depthStencilView.viewType = VK_IMAGE_VIEW_TYPE_2D;
-  depthStencilView.format = depthFormat;
-  depthStencilView.flags = 0;
-  depthStencilView.subresourceRange = {};
-  depthStencilView.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
-  depthStencilView.subresourceRange.baseMipLevel = 0;
-  depthStencilView.subresourceRange.levelCount = 1;
-  depthStencilView.subresourceRange.baseArrayLayer = 0;
-  depthStencilView.subresourceRange.layerCount = 1;
-  depthStencilView.image = depthAttachment.image;
-
-  VK_CHECK_RESULT(vkCreateImageView(device, &depthStencilView, nullptr, &depthAttachment.view))
+  // D32_SFLOAT has no stencil, so the view covers depth alone
+  depthAttachment = CreateImage(image, VK_IMAGE_ASPECT_DEPTH_BIT);
 }
 
 void HeadlessVulkan::CreateRenderPass() {
@@ -360,20 +473,22 @@ void HeadlessVulkan::CreateRenderPass() {
   // Use subpass dependencies for layout transitions
   std::array<VkSubpassDependency, 2> dependencies{};
 
+  // the previous tile's readback or reduction must finish reading before the
+  // next tile clears the attachment
   dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
   dependencies[0].dstSubpass = 0;
-  dependencies[0].srcStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+  dependencies[0].srcStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
   dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-  dependencies[0].srcAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+  dependencies[0].srcAccessMask = 0;
   dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
   dependencies[0].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
 
   dependencies[1].srcSubpass = 0;
   dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
   dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-  dependencies[1].dstStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+  dependencies[1].dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
   dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-  dependencies[1].dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+  dependencies[1].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
   dependencies[1].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
 
   // Create the actual renderpass
@@ -395,14 +510,14 @@ void HeadlessVulkan::CreateRenderPass() {
   framebufferCreateInfo.renderPass = renderPass;
   framebufferCreateInfo.attachmentCount = 2;
   framebufferCreateInfo.pAttachments = attachments;
-  framebufferCreateInfo.width = width;
-  framebufferCreateInfo.height = height;
-  framebufferCreateInfo.layers = 1;
+  framebufferCreateInfo.width = tileWidth;
+  framebufferCreateInfo.height = tileHeight;
+  framebufferCreateInfo.layers = layers;
 
   VK_CHECK_RESULT(vkCreateFramebuffer(device, &framebufferCreateInfo, nullptr, &framebuffer))
 }
 
-void HeadlessVulkan::CreatePipeline(VkPipelineVertexInputStateCreateInfo& vertexInputState) {
+void HeadlessVulkan::CreatePipeline(VkPipelineVertexInputStateCreateInfo& vertexInputState, const PipelineShaders& shaders) {
 
   std::vector<VkDescriptorSetLayoutBinding> setLayoutBindings = {};
   VkDescriptorSetLayoutCreateInfo descriptorLayout =
@@ -412,27 +527,34 @@ void HeadlessVulkan::CreatePipeline(VkPipelineVertexInputStateCreateInfo& vertex
     VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo =
     vks::initializers::pipelineLayoutCreateInfo(nullptr, 0);
 
-  VK_CHECK_RESULT(vkCreatePipelineLayout(device, &pipelineLayoutCreateInfo, nullptr, &pipelineLayout))
+  // scale and offset taking image device coordinates onto the current tile
+  VkPushConstantRange pushConstantRange = vks::initializers::pushConstantRange(VK_SHADER_STAGE_VERTEX_BIT, 4 * sizeof(float), 0);
+  pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+  pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
 
-    VkPipelineCacheCreateInfo pipelineCacheCreateInfo = {};
-  pipelineCacheCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
-  VK_CHECK_RESULT(vkCreatePipelineCache(device, &pipelineCacheCreateInfo, nullptr, &pipelineCache))
+  VK_CHECK_RESULT(vkCreatePipelineLayout(device, &pipelineLayoutCreateInfo, nullptr, &pipelineLayout))
 
     // Create pipeline
     VkPipelineInputAssemblyStateCreateInfo inputAssemblyState =
-    vks::initializers::pipelineInputAssemblyStateCreateInfo(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_FAN, 0, VK_FALSE);
+    vks::initializers::pipelineInputAssemblyStateCreateInfo(shaders.topology, 0, VK_FALSE);
 
   VkPipelineRasterizationStateCreateInfo rasterizationState =
     vks::initializers::pipelineRasterizationStateCreateInfo(VK_POLYGON_MODE_FILL, VK_CULL_MODE_NONE, VK_FRONT_FACE_CLOCKWISE);
 
   VkPipelineColorBlendAttachmentState blendAttachmentState =
-    vks::initializers::pipelineColorBlendAttachmentState(0xf, VK_FALSE);
+    vks::initializers::pipelineColorBlendAttachmentState(0xf, shaders.blend ? VK_TRUE : VK_FALSE);
+  blendAttachmentState.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+  blendAttachmentState.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+  blendAttachmentState.colorBlendOp = VK_BLEND_OP_ADD;
+  blendAttachmentState.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+  blendAttachmentState.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+  blendAttachmentState.alphaBlendOp = VK_BLEND_OP_ADD;
 
   VkPipelineColorBlendStateCreateInfo colorBlendState =
     vks::initializers::pipelineColorBlendStateCreateInfo(1, &blendAttachmentState);
 
   VkPipelineDepthStencilStateCreateInfo depthStencilState =
-    vks::initializers::pipelineDepthStencilStateCreateInfo(VK_TRUE, VK_TRUE, VK_COMPARE_OP_LESS_OR_EQUAL);
+    vks::initializers::pipelineDepthStencilStateCreateInfo(shaders.blend ? VK_FALSE : VK_TRUE, shaders.blend ? VK_FALSE : VK_TRUE, VK_COMPARE_OP_LESS_OR_EQUAL);
 
   VkPipelineViewportStateCreateInfo viewportState =
     vks::initializers::pipelineViewportStateCreateInfo(1, 1);
@@ -474,94 +596,299 @@ void HeadlessVulkan::CreatePipeline(VkPipelineVertexInputStateCreateInfo& vertex
   shaderStages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
   shaderStages[1].pName = "main";
 
-  shaderStages[0].module = LoadShader(SHADER_PATH "vert.spv");
-  shaderStages[1].module = LoadShader(SHADER_PATH "frag.spv");
+  shaderStages[0].module = LoadShader(shaders.vertex);
+  shaderStages[1].module = LoadShader(shaders.fragment);
 
   shaderModules = { shaderStages[0].module, shaderStages[1].module };
 
   VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineCreateInfo, nullptr, &pipeline))
 }
 
-void HeadlessVulkan::RenderImage(std::vector<VkBuffer> buffers, uint32_t vertexCount, uint32_t instanceCount) {
-  VkCommandBuffer commandBuffer;
-  VkCommandBufferAllocateInfo cmdBufAllocateInfo =
-    vks::initializers::commandBufferAllocateInfo(commandPool,
-        VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1);
+void HeadlessVulkan::UpdateRenderCommand(const std::vector<DrawBatch>& batches) {
+  if (batches.size() > MAX_DRAW_BATCHES) {
+    throw std::runtime_error("too many draw batches!");
+  }
 
-  VK_CHECK_RESULT(vkAllocateCommandBuffers(device, &cmdBufAllocateInfo, &commandBuffer))
+  // the indirect counts and render commands are in use until the last
+  // render completes, whichever fence it went out on
+  CompletePending();
 
-    VkCommandBufferBeginInfo cmdBufInfo =
-    vks::initializers::commandBufferBeginInfo();
+  bool rerecord = batches.size() != recordedBatches.size();
+
+  for (size_t i = 0; i < batches.size(); i++) {
+    indirectCommands[i].vertexCount = batches[i].vertexCount;
+    if (!batches[i].deviceCount) {
+      indirectCommands[i].instanceCount = batches[i].instanceCount;
+    }
 
-  VK_CHECK_RESULT(vkBeginCommandBuffer(commandBuffer, &cmdBufInfo))
+    rerecord = rerecord || batches[i].buffers != recordedBatches[i].buffers;
+  }
+
+  if (!rerecord) {
+    return;
+  }
 
-    VkClearValue clearValues[2];
-  clearValues[0].color = { { 0.0f, 0.0f, 0.0f, 1.0f } };
+  VkClearValue clearValues[2];
+  clearValues[0].color = clearColor;
   clearValues[1].depthStencil = { 1.0f, 0 };
 
   VkRenderPassBeginInfo renderPassBeginInfo = {};
   renderPassBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-  renderPassBeginInfo.renderArea.extent.width = width;
-  renderPassBeginInfo.renderArea.extent.height = height;
+  renderPassBeginInfo.renderArea.extent.width = tileWidth;
+  renderPassBeginInfo.renderArea.extent.height = tileHeight;
   renderPassBeginInfo.clearValueCount = 2;
   renderPassBeginInfo.pClearValues = clearValues;
   renderPassBeginInfo.renderPass = renderPass;
   renderPassBeginInfo.framebuffer = framebuffer;
 
-  vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
-
   VkViewport viewport = {};
-  viewport.height = (float)height;
-  viewport.width = (float)width;
+  viewport.height = (float)tileHeight;
+  viewport.width = (float)tileWidth;
   viewport.minDepth = (float)0.0f;
   viewport.maxDepth = (float)1.0f;
-  vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
 
-  // Update dynamic scissor state
   VkRect2D scissor = {};
-  scissor.extent.width = width;
-  scissor.extent.height = height;
-  vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+  scissor.extent.width = tileWidth;
+  scissor.extent.height = tileHeight;
+
+  VkCommandBufferBeginInfo cmdBufInfo =
+    vks::initializers::commandBufferBeginInfo();
+
+  for (const RenderTile& tile : tiles) {
+    VK_CHECK_RESULT(vkResetCommandBuffer(tile.render, 0))
+    VK_CHECK_RESULT(vkBeginCommandBuffer(tile.render, &cmdBufInfo))
+    BeginTimestamp(tile.render, &DeviceTimings::render);
+
+    vkCmdBeginRenderPass(tile.render, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+    vkCmdSetViewport(tile.render, 0, 1, &viewport);
+    vkCmdSetScissor(tile.render, 0, 1, &scissor);
+    vkCmdBindPipeline(tile.render, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+
+    // stretch the image so the tile fills the framebuffer; depth is untouched
+    const float transform[4] = {
+      static_cast<float>(width) / tileWidth,
+      static_cast<float>(height) / tileHeight,
+      static_cast<float>(width - 2 * tile.x) / tileWidth - 1.0f,
+      static_cast<float>(height - 2 * tile.y) / tileHeight - 1.0f
+    };
+    vkCmdPushConstants(tile.render, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(transform), transform);
+
+    for (size_t i = 0; i < batches.size(); i++) {
+      std::vector<VkDeviceSize> offsets(batches[i].buffers.size(), 0);
+      vkCmdBindVertexBuffers(tile.render, 0, batches[i].buffers.size(), batches[i].buffers.data(), offsets.data());
+
+      vkCmdDrawIndirect(tile.render, indirectBuffer, i * sizeof(VkDrawIndirectCommand), 1, sizeof(VkDrawIndirectCommand));
+    }
+
+    vkCmdEndRenderPass(tile.render);
+
+    EndTimestamp(tile.render);
+    VK_CHECK_RESULT(vkEndCommandBuffer(tile.render))
+  }
+
+  recordedBatches = batches;
+}
+
+void HeadlessVulkan::SetClearColor(const VkClearColorValue& color) {
+  // the clear is recorded into the render commands
+  CompletePending();
+  clearColor = color;
+  recordedBatches.clear();
+}
+
+void HeadlessVulkan::RenderImage(const std::vector<DrawBatch>& batches) {
+  RenderImageAsync(batches).Wait();
+}
+
+LabelMap HeadlessVulkan::RenderAndMapImage(const std::vector<DrawBatch>& batches) {
+  return RenderAndMapImageAsync(batches).Get();
+}
+
+DeviceSubmission HeadlessVulkan::RenderImageAsync(const std::vector<DrawBatch>& batches) {
+  UpdateRenderCommand(batches);
+  return SubmitWorkAsync(GetTileCommands(nullptr), renderFence);
+}
 
-  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+DeviceFuture<LabelMap> HeadlessVulkan::RenderAndMapImageAsync(const std::vector<DrawBatch>& batches) {
+  UpdateRenderCommand(batches);
+  CreateReadbackBuffer();
 
-  // Render scene
-  VkDeviceSize offsets[3] = { 0, 0, 0 };
-  vkCmdBindVertexBuffers(commandBuffer, 0, 3, buffers.data(), offsets);
+  // a tiled image is gathered through the one tile readback before this
+  // returns, there is nothing left in flight
+  if (tiles.size() > 1) {
+    ReadTiles();
+    return DeviceFuture<LabelMap>(DeviceSubmission(), [this]() { return GetReadbackView(); });
+  }
 
-  vkCmdDraw(commandBuffer, vertexCount, instanceCount, 0, 0);
+  // render and readback go out as one batch with a single fence to wait on
+  return DeviceFuture<LabelMap>(
+      SubmitWorkAsync({ tiles[0].render, tiles[0].readback }, renderFence),
+      [this]() { return GetReadbackView(); });
+}
 
-  vkCmdEndRenderPass(commandBuffer);
+LabelMap HeadlessVulkan::RenderAndStreamImage(const std::vector<DrawBatch>& batches, const LabelBandCallback& band) {
+  UpdateRenderCommand(batches);
+  CreateReadbackBuffer();
+
+  // a tile's bands are all queued before the first is waited on, its render
+  // going out with the first band; the readback holds one tile, so the next
+  // tile is only queued once the host has every band of this one
+  LabelMap view;
+  for (const RenderTile& tile : tiles) {
+    std::vector<DeviceSubmission> submissions;
+    for (size_t i = 0; i < tile.bands.size(); i++) {
+      std::vector<VkCommandBuffer> cmdBuffers;
+      if (i == 0) {
+        cmdBuffers.push_back(tile.render);
+      }
+      cmdBuffers.push_back(tile.bands[i].copy);
+      submissions.push_back(SubmitWorkAsync(cmdBuffers, tile.bands[i].fence));
+    }
 
-  VK_CHECK_RESULT(vkEndCommandBuffer(commandBuffer))
+    // the host works on each band while the ones after it are still copying
+    for (size_t i = 0; i < tile.bands.size(); i++) {
+      submissions[i].Wait();
+      if (tiles.size() > 1) {
+        GatherRegion(tile, tile.bands[i].region);
+      }
+      view = GetReadbackView();
+      band(view, tile.bands[i].region);
+    }
+  }
 
-    SubmitWork(commandBuffer, queue);
+  return view;
+}
+
+std::vector<LabelMap> HeadlessVulkan::RenderAndMapLayers(const std::vector<DrawBatch>& batches) {
+  RenderAndMapImage(batches);
+
+  std::vector<LabelMap> views;
+  for (uint32_t layer = 0; layer < layers; layer++) {
+    views.push_back(GetReadbackView(layer));
+  }
+
+  return views;
+}
 
-  vkDeviceWaitIdle(device);
+cimg_library::CImg<uint32_t> HeadlessVulkan::RenderAndCopyImage(const std::vector<DrawBatch>& batches) {
+  return ToCImg(RenderAndMapImage(batches));
 }
 
-void HeadlessVulkan::SubmitWork(VkCommandBuffer cmdBuffer, VkQueue queue)
+void HeadlessVulkan::SubmitWork(const std::vector<VkCommandBuffer>& cmdBuffers, VkFence fence)
 {
+  SubmitWorkAsync(cmdBuffers, fence).Wait();
+}
+
+
+DeviceSubmission HeadlessVulkan::SubmitWorkAsync(const std::vector<VkCommandBuffer>& cmdBuffers, VkFence fence)
+{
+  // one submission per fence at a time, the previous one is finished first
+  CompleteWork(fence);
+
   VkSubmitInfo submitInfo = vks::initializers::submitInfo();
-  submitInfo.commandBufferCount = 1;
-  submitInfo.pCommandBuffers = &cmdBuffer;
-  VkFenceCreateInfo fenceInfo = vks::initializers::fenceCreateInfo();
-  VkFence fence;
-  VK_CHECK_RESULT(vkCreateFence(device, &fenceInfo, nullptr, &fence))
-    VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, fence))
-    VK_CHECK_RESULT(vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX))
-    vkDestroyFence(device, fence, nullptr);
+  submitInfo.commandBufferCount = static_cast<uint32_t>(cmdBuffers.size());
+  submitInfo.pCommandBuffers = cmdBuffers.data();
+  VK_CHECK_RESULT(vkResetFences(device, 1, &fence))
+  context->Submit(submitInfo, fence, queueIndex);
+
+  FenceState& state = fenceStates[fence];
+  state.serial++;
+  state.pending = true;
+  state.cmdBuffers = cmdBuffers;
+
+  return DeviceSubmission(this, fence, state.serial);
+}
+
+
+bool HeadlessVulkan::IsComplete(VkFence fence, uint64_t serial) {
+  const FenceState& state = fenceStates[fence];
+  return state.serial != serial || !state.pending || vkGetFenceStatus(device, fence) == VK_SUCCESS;
+}
+
+
+void HeadlessVulkan::CompleteWork(VkFence fence, uint64_t serial) {
+  // a later submission on the fence has already completed this one
+  if (fenceStates[fence].serial == serial) {
+    CompleteWork(fence);
+  }
 }
 
 
-VkShaderModule HeadlessVulkan::LoadShader(std::string shaderPath) {
+void HeadlessVulkan::CompleteWork(VkFence fence) {
+  FenceState& state = fenceStates[fence];
+  if (!state.pending) {
+    return;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  VK_CHECK_RESULT(vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX))
+  timings.wait += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+  state.pending = false;
+  CollectTimestamps(state.cmdBuffers);
+}
+
+
+DeviceSubmission::DeviceSubmission(HeadlessVulkan* _owner, VkFence _fence, uint64_t _serial)
+  : owner(_owner), fence(_fence), serial(_serial) {}
+
+
+DeviceSubmission::DeviceSubmission(DeviceSubmission&& other) noexcept
+  : owner(other.owner), fence(other.fence), serial(other.serial) {
+  other.owner = nullptr;
+}
+
+
+DeviceSubmission& DeviceSubmission::operator=(DeviceSubmission&& other) noexcept {
+  if (this != &other) {
+    Wait();
+    owner = other.owner;
+    fence = other.fence;
+    serial = other.serial;
+    other.owner = nullptr;
+  }
+
+  return *this;
+}
+
+
+bool DeviceSubmission::Ready() const {
+  return owner == nullptr || owner->IsComplete(fence, serial);
+}
+
+
+void DeviceSubmission::Wait() {
+  if (owner == nullptr) {
+    return;
+  }
+
+  owner->CompleteWork(fence, serial);
+  owner = nullptr;
+}
+
 
-  std::vector<char> code = ReadFile(shaderPath);
+VkShaderModule HeadlessVulkan::LoadShader(std::string name) {
+  // shaders are compiled into the binary; SHADER_PATH_ENV names a directory
+  // of .spv files to use instead
+  const char* overridePath = std::getenv(SHADER_PATH_ENV);
+  const EmbeddedShader* embedded = FindEmbeddedShader(name);
 
   VkShaderModuleCreateInfo createInfo = {};
   createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-  createInfo.codeSize = code.size();
-  createInfo.pCode = reinterpret_cast<const uint32_t*>(code.data());
+
+  std::vector<char> code;
+  if (overridePath != nullptr) {
+    code = ReadFile(std::string(overridePath) + "/" + name);
+    createInfo.codeSize = code.size();
+    createInfo.pCode = reinterpret_cast<const uint32_t*>(code.data());
+  }
+  else if (embedded != nullptr) {
+    createInfo.codeSize = embedded->size;
+    createInfo.pCode = embedded->code;
+  }
+  else {
+    throw std::runtime_error("no embedded shader " + name + "!");
+  }
 
   VkShaderModule shaderModule;
   if (vkCreateShaderModule(device, &createInfo, nullptr, &shaderModule) != VK_SUCCESS) {
@@ -572,146 +899,754 @@ VkShaderModule HeadlessVulkan::LoadShader(std::string shaderPath) {
 }
 
 
-cimg_library::CImg<unsigned char> HeadlessVulkan::CopyImage() {
-  const char* imagedata;
-  // Create the linear tiled destination image to copy to and to read the memory from
-  VkImageCreateInfo imgCreateInfo(vks::initializers::imageCreateInfo());
-  imgCreateInfo.imageType = VK_IMAGE_TYPE_2D;
-  imgCreateInfo.format = VK_FORMAT_R8G8B8A8_UNORM;
-  imgCreateInfo.extent.width = width;
-  imgCreateInfo.extent.height = height;
-  imgCreateInfo.extent.depth = 1;
-  imgCreateInfo.arrayLayers = 1;
-  imgCreateInfo.mipLevels = 1;
-  imgCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-  imgCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
-  imgCreateInfo.tiling = VK_IMAGE_TILING_LINEAR;
-  imgCreateInfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT;
-  //
-  // Create the image
-  VkImage dstImage;
-  VK_CHECK_RESULT(vkCreateImage(device, &imgCreateInfo, nullptr, &dstImage))
-    //
-    // Create memory to back up the image
-    VkMemoryRequirements memRequirements;
-  VkMemoryAllocateInfo memAllocInfo(vks::initializers::memoryAllocateInfo());
-  VkDeviceMemory dstImageMemory;
-  vkGetImageMemoryRequirements(device, dstImage, &memRequirements);
-  memAllocInfo.allocationSize = memRequirements.size;
-  //
-  // Memory must be host visible to copy from
-  memAllocInfo.memoryTypeIndex = GetMemoryTypeIndex(memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-  VK_CHECK_RESULT(vkAllocateMemory(device, &memAllocInfo, nullptr, &dstImageMemory))
-    VK_CHECK_RESULT(vkBindImageMemory(device, dstImage, dstImageMemory, 0))
-
-    // Do the actual blit from the offscreen image to our host visible destination image
-    VkCommandBufferAllocateInfo cmdBufAllocateInfo = vks::initializers::commandBufferAllocateInfo(commandPool, VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1);
-  VkCommandBuffer copyCmd;
-  VK_CHECK_RESULT(vkAllocateCommandBuffers(device, &cmdBufAllocateInfo, &copyCmd))
-    VkCommandBufferBeginInfo cmdBufInfo = vks::initializers::commandBufferBeginInfo();
-  VK_CHECK_RESULT(vkBeginCommandBuffer(copyCmd, &cmdBufInfo))
-
-    // Transition destination image to transfer destination layout
-    insertImageMemoryBarrier(
-        copyCmd,
-        dstImage,
-        0,
-        VK_ACCESS_TRANSFER_WRITE_BIT,
-        VK_IMAGE_LAYOUT_UNDEFINED,
-        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-        VK_PIPELINE_STAGE_TRANSFER_BIT,
-        VK_PIPELINE_STAGE_TRANSFER_BIT,
-        VkImageSubresourceRange{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 });
+void HeadlessVulkan::CreateReadbackBuffer() {
+  // made on the first read, an instance that only reduces moments never
+  // needs it
+  if (readbackBuffer.buffer != VK_NULL_HANDLE) {
+    return;
+  }
+
+  // Map once, the view of a single tile image points straight into this
+  // memory; one tile, layers follow one another
+  const VkDeviceSize size = static_cast<VkDeviceSize>(tileWidth) * tileHeight * bytesPerPixel * layers;
+  readbackBuffer = CreateHostBuffer(VK_BUFFER_USAGE_TRANSFER_DST_BIT, size);
+  readbackData = static_cast<const unsigned char*>(readbackBuffer.Mapped());
+
+  if (tiles.size() > 1) {
+    tiledLabels.resize(static_cast<size_t>(width) * height * bytesPerPixel * layers);
+  }
+
+  RecordCopyImage();
+}
+
+
+DeviceBuffer HeadlessVulkan::CreateHostBuffer(VkBufferUsageFlags usageFlags, VkDeviceSize size) {
+  VkBuffer buffer;
+  VkBufferCreateInfo bufferCreateInfo = vks::initializers::bufferCreateInfo(usageFlags, size);
+  bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  VK_CHECK_RESULT(vkCreateBuffer(device, &bufferCreateInfo, nullptr, &buffer))
+
+  VkMemoryRequirements memRequirements;
+  vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
+
+  // Memory must be host visible to copy from, cached memory is much faster to
+  // read on the host but may need invalidating
+  uint32_t typeIndex;
+  if (!FindMemoryType(memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT, &typeIndex)) {
+    typeIndex = GetMemoryTypeIndex(memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+  }
+
+  MemoryAllocation allocation = context->allocator.Allocate(memRequirements, typeIndex, true);
+  VK_CHECK_RESULT(vkBindBufferMemory(device, buffer, allocation.block->memory, allocation.offset))
+
+  return DeviceBuffer(context, buffer, allocation);
+}
+
+
+void HeadlessVulkan::InvalidateHostBuffer(const DeviceBuffer& buffer) {
+  // a no-op for coherent memory
+  buffer.Invalidate();
+}
+
+
+void HeadlessVulkan::RecordCopyImage() {
+  // the whole tile for MapImage, and the same copy split into bands for
+  // streamed readbacks
+  for (const RenderTile& tile : tiles) {
+    RecordRegionCopy(tile.readback, tile, { tile.x, tile.y, static_cast<int>(tile.width), static_cast<int>(tile.height) });
+
+    for (const ReadbackBand& band : tile.bands) {
+      RecordRegionCopy(band.copy, tile, band.region);
+    }
+  }
+}
+
+
+void HeadlessVulkan::RecordRegionCopy(VkCommandBuffer cmdBuffer, const RenderTile& tile, const LabelRegion& region) {
+  VkCommandBufferBeginInfo cmdBufInfo = vks::initializers::commandBufferBeginInfo();
+  VK_CHECK_RESULT(vkBeginCommandBuffer(cmdBuffer, &cmdBufInfo))
+  BeginTimestamp(cmdBuffer, &DeviceTimings::readback);
 
   // colorAttachment.image is already in VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, and does not need to be transitioned
 
-  VkImageCopy imageCopyRegion{};
-  imageCopyRegion.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-  imageCopyRegion.srcSubresource.layerCount = 1;
-  imageCopyRegion.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-  imageCopyRegion.dstSubresource.layerCount = 1;
-  imageCopyRegion.extent.width = width;
-  imageCopyRegion.extent.height = height;
-  imageCopyRegion.extent.depth = 1;
-
-  vkCmdCopyImage(
-      copyCmd,
+  VkBufferImageCopy copyRegion{};
+  copyRegion.bufferOffset = (static_cast<VkDeviceSize>(region.y - tile.y) * tileWidth + (region.x - tile.x)) * bytesPerPixel;
+  copyRegion.bufferRowLength = tileWidth; // rows of the framebuffer
+  copyRegion.bufferImageHeight = tileHeight; // so each layer lands on its own image
+  copyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  copyRegion.imageSubresource.layerCount = layers;
+  copyRegion.imageOffset.x = region.x - tile.x;
+  copyRegion.imageOffset.y = region.y - tile.y;
+  copyRegion.imageExtent.width = region.width;
+  copyRegion.imageExtent.height = region.height;
+  copyRegion.imageExtent.depth = 1;
+
+  vkCmdCopyImageToBuffer(
+      cmdBuffer,
       colorAttachment.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-      dstImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+      readbackBuffer,
       1,
-      &imageCopyRegion);
-
-  // Transition destination image to general layout, which is the required layout for mapping the image memory later on
-  insertImageMemoryBarrier(
-      copyCmd,
-      dstImage,
-      VK_ACCESS_TRANSFER_WRITE_BIT,
-      VK_ACCESS_MEMORY_READ_BIT,
-      VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-      VK_IMAGE_LAYOUT_GENERAL,
-      VK_PIPELINE_STAGE_TRANSFER_BIT,
+      &copyRegion);
+
+  // make the copy visible to host reads once the fence signals
+  VkBufferMemoryBarrier bufferBarrier = vks::initializers::bufferMemoryBarrier();
+  bufferBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  bufferBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+  bufferBarrier.buffer = readbackBuffer;
+  bufferBarrier.offset = 0;
+  bufferBarrier.size = VK_WHOLE_SIZE;
+
+  vkCmdPipelineBarrier(
+      cmdBuffer,
       VK_PIPELINE_STAGE_TRANSFER_BIT,
-      VkImageSubresourceRange{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 });
+      VK_PIPELINE_STAGE_HOST_BIT,
+      0,
+      0, nullptr,
+      1, &bufferBarrier,
+      0, nullptr);
+
+  EndTimestamp(cmdBuffer);
+  VK_CHECK_RESULT(vkEndCommandBuffer(cmdBuffer))
+}
+
+
+void HeadlessVulkan::GatherRegion(const RenderTile& tile, const LabelRegion& region) {
+  // from the tile readback into its place in the whole image
+  InvalidateHostBuffer(readbackBuffer);
+
+  const size_t rowSize = static_cast<size_t>(region.width) * bytesPerPixel;
+  for (uint32_t layer = 0; layer < layers; layer++) {
+    const unsigned char* src = readbackData + static_cast<size_t>(layer) * tileWidth * tileHeight * bytesPerPixel;
+    unsigned char* dst = tiledLabels.data() + static_cast<size_t>(layer) * width * height * bytesPerPixel;
+
+    for (int32_t y = region.y; y < region.y + region.height; y++) {
+      memcpy(dst + (static_cast<size_t>(y) * width + region.x) * bytesPerPixel,
+             src + (static_cast<size_t>(y - tile.y) * tileWidth + (region.x - tile.x)) * bytesPerPixel,
+             rowSize);
+    }
+  }
+}
 
-  VK_CHECK_RESULT(vkEndCommandBuffer(copyCmd))
-    SubmitWork(copyCmd, queue);
 
-  // Get layout of the image (including row pitch)
-  VkImageSubresource subResource{};
-  subResource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-  VkSubresourceLayout subResourceLayout;
+void HeadlessVulkan::ReadTiles() {
+  // tiles share the framebuffer and the readback, so each is rendered, read
+  // and gathered before the next
+  for (const RenderTile& tile : tiles) {
+    SubmitWork({ tile.render, tile.readback }, renderFence);
+    GatherRegion(tile, { tile.x, tile.y, static_cast<int>(tile.width), static_cast<int>(tile.height) });
+  }
+}
 
-  vkGetImageSubresourceLayout(device, dstImage, &subResource, &subResourceLayout);
 
-  // Map image memory so we can start copying from it
-  vkMapMemory(device, dstImageMemory, 0, VK_WHOLE_SIZE, 0, (void**)&imagedata);
-  imagedata += subResourceLayout.offset;
+LabelMap HeadlessVulkan::GetReadbackView(uint32_t layer) {
+  // a single tile is the whole image, its readback is viewed directly
+  const unsigned char* data = tiledLabels.data();
+  if (tiles.size() == 1) {
+    InvalidateHostBuffer(readbackBuffer);
+    data = readbackData;
+  }
 
-  cimg_library::CImg<unsigned char> out(width, height, 1, 3);
+  LabelMap view;
+  view.data = data + static_cast<size_t>(layer) * width * height * bytesPerPixel;
+  view.rowPitch = width * bytesPerPixel;
+  view.width = width;
+  view.height = height;
+  view.bytesPerLabel = bytesPerPixel;
+  return view;
+}
+
+
+cimg_library::CImg<uint32_t> HeadlessVulkan::ToCImg(const LabelMap& view) {
+  cimg_library::CImg<uint32_t> out(width, height, 1, 1);
 
   for (int32_t y = 0; y < height; y++) {
-    unsigned int *row = (unsigned int*)imagedata;
     for (int32_t x = 0; x < width; x++) {
-      // channels are char* wide, TODO: construct CImg
+      out(x, y) = view.At(x, y);
+    }
+  }
+
+  return out;
+}
+
+
+LabelMap HeadlessVulkan::MapImage() {
+  // Do the actual blit from the offscreen image to our host visible destination image
+  CreateReadbackBuffer();
+  if (tiles.size() == 1) {
+    SubmitWork({ tiles[0].readback }, renderFence);
+    return GetReadbackView();
+  }
+
+  // only the last tile is left in the framebuffer, render the others again
+  if (recordedBatches.empty()) {
+    throw std::runtime_error("nothing has been rendered to map!");
+  }
+
+  ReadTiles();
+  return GetReadbackView();
+}
+
+
+cimg_library::CImg<uint32_t> HeadlessVulkan::CopyImage() {
+  return ToCImg(MapImage());
+}
+
+
+void HeadlessVulkan::SetDensity(const std::vector<float>& density) {
+  if (!floatAtomics) {
+    throw std::runtime_error("moment reduction requires float atomics!");
+  }
+
+  if (layers > 1) {
+    throw std::runtime_error("moment reduction of layered images is not supported!");
+  }
 
-      out(x, y, 0) = (unsigned int)((*row >> 0) & 0x000000ff);
-      out(x, y, 1) = (unsigned int)((*row >> 8) & 0x000000ff);
-      out(x, y, 2) = (unsigned int)((*row >> 16) & 0x000000ff);
+  if (density.size() != static_cast<size_t>(width) * height) {
+    throw std::runtime_error("density does not match the framebuffer!");
+  }
 
-      row++;
+  const VkDeviceSize size = density.size() * sizeof(float);
+
+  // a pending reduction may still be reading the density
+  CompletePending();
+
+  // uploaded once per image, the pipeline is only built once it is needed;
+  // the device holds a single tile of density, a tiled image keeps the rest
+  // in host memory and writes each tile's rows into one of two tile sized
+  // stagings as it goes, the other still being copied from
+  if (densityBuffer.buffer == VK_NULL_HANDLE) {
+    const VkDeviceSize tileSize = static_cast<VkDeviceSize>(tileWidth) * tileHeight * sizeof(float);
+    densityBuffer = CreateBuffer(
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        tileSize);
+
+    if (tiles.size() > 1) {
+      VkFenceCreateInfo fenceInfo = vks::initializers::fenceCreateInfo(VK_FENCE_CREATE_SIGNALED_BIT);
+      for (uint32_t i = 0; i < 2; i++) {
+        densityStaging[i] = CreateBuffer(
+            VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            tileSize);
+        densityStagingData[i] = static_cast<float*>(densityStaging[i].Mapped());
+        VK_CHECK_RESULT(vkCreateFence(device, &fenceInfo, nullptr, &densityFences[i]))
+      }
     }
-    imagedata += subResourceLayout.rowPitch;
+
+    CreateMomentPipeline();
   }
 
-  vkUnmapMemory(device, dstImageMemory);
-  vkFreeMemory(device, dstImageMemory, nullptr);
-  vkDestroyImage(device, dstImage, nullptr);
-  vkQueueWaitIdle(queue);
+  if (tiles.size() > 1) {
+    tiledDensity = density;
+  }
+  else {
+    CopyData(density.data(), size, densityBuffer);
+  }
+}
 
-  return out;
+
+void HeadlessVulkan::CreateMomentPipeline() {
+  // labels are integers, so are only ever fetched, never filtered
+  VkSamplerCreateInfo samplerInfo = vks::initializers::samplerCreateInfo();
+  samplerInfo.magFilter = VK_FILTER_NEAREST;
+  samplerInfo.minFilter = VK_FILTER_NEAREST;
+  samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+  samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  VK_CHECK_RESULT(vkCreateSampler(device, &samplerInfo, nullptr, &labelSampler))
+
+  std::vector<VkDescriptorSetLayoutBinding> setLayoutBindings = {
+    vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT, 0),
+    vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 1),
+    vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 2)
+  };
+  VkDescriptorSetLayoutCreateInfo descriptorLayout =
+    vks::initializers::descriptorSetLayoutCreateInfo(setLayoutBindings);
+  VK_CHECK_RESULT(vkCreateDescriptorSetLayout(device, &descriptorLayout, nullptr, &momentSetLayout))
+
+  std::vector<VkDescriptorPoolSize> poolSizes = {
+    vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1),
+    vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2)
+  };
+  VkDescriptorPoolCreateInfo poolInfo = vks::initializers::descriptorPoolCreateInfo(poolSizes, 1);
+  VK_CHECK_RESULT(vkCreateDescriptorPool(device, &poolInfo, nullptr, &descriptorPool))
+
+  VkDescriptorSetAllocateInfo allocInfo = vks::initializers::descriptorSetAllocateInfo(descriptorPool, &momentSetLayout, 1);
+  VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &allocInfo, &momentSet))
+
+  // tile extent, the empty label, density row length and the tile origin
+  VkPushConstantRange pushConstantRange = vks::initializers::pushConstantRange(VK_SHADER_STAGE_COMPUTE_BIT, 6 * sizeof(uint32_t), 0);
+  VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = vks::initializers::pipelineLayoutCreateInfo(&momentSetLayout, 1);
+  pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+  pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+  VK_CHECK_RESULT(vkCreatePipelineLayout(device, &pipelineLayoutCreateInfo, nullptr, &momentPipelineLayout))
+
+  VkComputePipelineCreateInfo pipelineCreateInfo = vks::initializers::computePipelineCreateInfo(momentPipelineLayout);
+  pipelineCreateInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  pipelineCreateInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+  pipelineCreateInfo.stage.pName = "main";
+  pipelineCreateInfo.stage.module = LoadShader("moments.comp.spv");
+  shaderModules.push_back(pipelineCreateInfo.stage.module);
+
+  VK_CHECK_RESULT(vkCreateComputePipelines(device, pipelineCache, 1, &pipelineCreateInfo, nullptr, &momentPipeline))
+
+  // the label attachment never changes, only the moment buffer is rebound
+  VkDescriptorImageInfo labelInfo = vks::initializers::descriptorImageInfo(labelSampler, colorAttachment.view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+  VkDescriptorBufferInfo densityInfo = { densityBuffer.buffer, 0, VK_WHOLE_SIZE };
+
+  std::vector<VkWriteDescriptorSet> writes = {
+    vks::initializers::writeDescriptorSet(momentSet, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 0, &labelInfo),
+    vks::initializers::writeDescriptorSet(momentSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, &densityInfo)
+  };
+  vkUpdateDescriptorSets(device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+}
+
+
+void HeadlessVulkan::CreateMomentBuffer(uint32_t cells) {
+  // grows geometrically like the vertex buffers, the reduction is recorded
+  // again only when the buffer is replaced
+
+  if (cells <= momentCapacity) {
+    return;
+  }
+
+  momentCapacity = std::max<uint32_t>(momentCapacity, 1024);
+  while (momentCapacity < cells) {
+    momentCapacity *= 2;
+  }
+
+  const VkDeviceSize size = static_cast<VkDeviceSize>(momentCapacity) * MOMENT_COUNT * sizeof(float);
+
+  // the old buffers go back to their blocks as they are replaced, once the
+  // last reduction into them has completed
+  CompletePending();
+  momentBuffer = CreateBuffer(
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+      size);
+
+  // cached memory reads faster on the host, as for the label readback
+  momentReadbackBuffer = CreateHostBuffer(VK_BUFFER_USAGE_TRANSFER_DST_BIT, size);
+  momentData = static_cast<const float*>(momentReadbackBuffer.Mapped());
+
+  VkDescriptorBufferInfo momentInfo = { momentBuffer.buffer, 0, VK_WHOLE_SIZE };
+  VkWriteDescriptorSet write = vks::initializers::writeDescriptorSet(momentSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2, &momentInfo);
+  vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+
+  RecordMoments();
+}
+
+
+void HeadlessVulkan::RecordMoments() {
+  VkCommandBufferBeginInfo cmdBufInfo = vks::initializers::commandBufferBeginInfo();
+  VK_CHECK_RESULT(vkBeginCommandBuffer(momentClearCommand, &cmdBufInfo))
+  BeginTimestamp(momentClearCommand, &DeviceTimings::moments);
+
+  const VkDeviceSize size = static_cast<VkDeviceSize>(momentCapacity) * MOMENT_COUNT * sizeof(float);
+
+  // every tile accumulates into the same moments
+  vkCmdFillBuffer(momentClearCommand, momentBuffer, 0, size, 0);
+
+  VkBufferMemoryBarrier clearBarrier = vks::initializers::bufferMemoryBarrier();
+  clearBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  clearBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+  clearBarrier.buffer = momentBuffer;
+  clearBarrier.offset = 0;
+  clearBarrier.size = VK_WHOLE_SIZE;
+
+  vkCmdPipelineBarrier(
+      momentClearCommand,
+      VK_PIPELINE_STAGE_TRANSFER_BIT,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+      0,
+      0, nullptr,
+      1, &clearBarrier,
+      0, nullptr);
+
+  EndTimestamp(momentClearCommand);
+  VK_CHECK_RESULT(vkEndCommandBuffer(momentClearCommand))
+
+  for (size_t i = 0; i < tiles.size(); i++) {
+    const RenderTile& tile = tiles[i];
+    VK_CHECK_RESULT(vkBeginCommandBuffer(tile.moments, &cmdBufInfo))
+    BeginTimestamp(tile.moments, &DeviceTimings::moments);
+
+    if (tiles.size() > 1) {
+      // this tile's rows of density, already packed to the framebuffer width
+      // in its staging; the previous tile's reduction has finished reading
+      // the device copy
+      VkBufferCopy rows = {};
+      rows.size = static_cast<VkDeviceSize>(tile.height) * tileWidth * sizeof(float);
+      vkCmdCopyBuffer(tile.moments, densityStaging[i % 2], densityBuffer, 1, &rows);
+
+      VkBufferMemoryBarrier densityBarrier = vks::initializers::bufferMemoryBarrier();
+      densityBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+      densityBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+      densityBarrier.buffer = densityBuffer;
+      densityBarrier.offset = 0;
+      densityBarrier.size = VK_WHOLE_SIZE;
+
+      vkCmdPipelineBarrier(
+          tile.moments,
+          VK_PIPELINE_STAGE_TRANSFER_BIT,
+          VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+          0,
+          0, nullptr,
+          1, &densityBarrier,
+          0, nullptr);
+    }
+
+    // the render pass leaves labels ready for transfer, sample them instead
+    VkImageMemoryBarrier labelBarrier = vks::initializers::imageMemoryBarrier();
+    labelBarrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    labelBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    labelBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    labelBarrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    labelBarrier.image = colorAttachment.image;
+    labelBarrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+
+    vkCmdPipelineBarrier(
+        tile.moments,
+        VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        0,
+        0, nullptr,
+        0, nullptr,
+        1, &labelBarrier);
+
+    // uncovered pixels carry an all ones label of the attachment's width
+    const uint32_t pushConstants[6] = {
+      tile.width,
+      tile.height,
+      bytesPerPixel == 2 ? 0xffffu : LABEL_EMPTY,
+      tileWidth,
+      static_cast<uint32_t>(tile.x),
+      static_cast<uint32_t>(tile.y)
+    };
+
+    vkCmdBindPipeline(tile.moments, VK_PIPELINE_BIND_POINT_COMPUTE, momentPipeline);
+    vkCmdBindDescriptorSets(tile.moments, VK_PIPELINE_BIND_POINT_COMPUTE, momentPipelineLayout, 0, 1, &momentSet, 0, nullptr);
+    vkCmdPushConstants(tile.moments, momentPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pushConstants), pushConstants);
+
+    // one invocation per run of each row
+    const uint32_t runs = (tile.width + MOMENT_RUN_LENGTH - 1) / MOMENT_RUN_LENGTH * tile.height;
+    vkCmdDispatch(tile.moments, (runs + MOMENT_GROUP_SIZE - 1) / MOMENT_GROUP_SIZE, 1, 1);
+
+    // moments are read either by the host copy, the next tile or by a pass
+    // chained after
+    VkBufferMemoryBarrier reduceBarrier = clearBarrier;
+    reduceBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    reduceBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+    // hand the labels back in the layout the readback expects
+    labelBarrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    labelBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    labelBarrier.oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    labelBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+
+    vkCmdPipelineBarrier(
+        tile.moments,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        0,
+        0, nullptr,
+        1, &reduceBarrier,
+        1, &labelBarrier);
+
+    EndTimestamp(tile.moments);
+    VK_CHECK_RESULT(vkEndCommandBuffer(tile.moments))
+  }
+
+  // copy to the host, separate so device resident passes can skip it
+  VK_CHECK_RESULT(vkBeginCommandBuffer(momentCopyCommand, &cmdBufInfo))
+  BeginTimestamp(momentCopyCommand, &DeviceTimings::moments);
+
+  VkBufferCopy copyRegion = {};
+  copyRegion.size = size;
+  vkCmdCopyBuffer(momentCopyCommand, momentBuffer, momentReadbackBuffer, 1, &copyRegion);
+
+  VkBufferMemoryBarrier hostBarrier = vks::initializers::bufferMemoryBarrier();
+  hostBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  hostBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+  hostBarrier.buffer = momentReadbackBuffer;
+  hostBarrier.offset = 0;
+  hostBarrier.size = VK_WHOLE_SIZE;
+
+  vkCmdPipelineBarrier(
+      momentCopyCommand,
+      VK_PIPELINE_STAGE_TRANSFER_BIT,
+      VK_PIPELINE_STAGE_HOST_BIT,
+      0,
+      0, nullptr,
+      1, &hostBarrier,
+      0, nullptr);
+
+  EndTimestamp(momentCopyCommand);
+  VK_CHECK_RESULT(vkEndCommandBuffer(momentCopyCommand))
+}
+
+
+void HeadlessVulkan::ReserveMoments(uint32_t cells) {
+  if (densityBuffer.buffer == VK_NULL_HANDLE) {
+    throw std::runtime_error("no density to reduce moments against!");
+  }
+
+  CreateMomentBuffer(cells);
+}
+
+
+const float* HeadlessVulkan::RenderAndReduceMoments(const std::vector<DrawBatch>& batches, uint32_t cells) {
+  return RenderAndReduceMomentsAsync(batches, cells).Get();
+}
+
+
+DeviceSubmission HeadlessVulkan::SubmitMoments(VkCommandBuffer last) {
+  if (tiles.size() == 1) {
+    return SubmitWorkAsync({ momentClearCommand, tiles[0].render, tiles[0].moments, last }, renderFence);
+  }
+
+  // each tile goes out on its own, its density written into the staging the
+  // tile before last has finished copying from
+  DeviceSubmission pending;
+  for (size_t i = 0; i < tiles.size(); i++) {
+    const uint32_t slot = i % 2;
+    CompleteWork(densityFences[slot]);
+
+    const RenderTile& tile = tiles[i];
+    for (uint32_t row = 0; row < tile.height; row++) {
+      memcpy(densityStagingData[slot] + static_cast<size_t>(row) * tileWidth,
+             tiledDensity.data() + (static_cast<size_t>(tile.y) + row) * width + tile.x,
+             tile.width * sizeof(float));
+    }
+
+    std::vector<VkCommandBuffer> cmdBuffers;
+    if (i == 0) {
+      cmdBuffers.push_back(momentClearCommand);
+    }
+    cmdBuffers.push_back(tile.render);
+    cmdBuffers.push_back(tile.moments);
+    if (i + 1 == tiles.size()) {
+      cmdBuffers.push_back(last);
+    }
+
+    // queue order finishes every earlier tile ahead of the last
+    pending = SubmitWorkAsync(cmdBuffers, densityFences[slot]);
+  }
+
+  return pending;
+}
+
+
+DeviceFuture<const float*> HeadlessVulkan::RenderAndReduceMomentsAsync(const std::vector<DrawBatch>& batches, uint32_t cells) {
+  ReserveMoments(cells);
+  UpdateRenderCommand(batches);
+
+  // MOMENT_COUNT floats per cell, valid until the next reduction
+  return DeviceFuture<const float*>(
+      SubmitMoments(momentCopyCommand),
+      [this]() {
+        InvalidateHostBuffer(momentReadbackBuffer);
+        return momentData;
+      });
+}
+
+
+void HeadlessVulkan::RenderAndReduceMoments(const std::vector<DrawBatch>& batches, VkCommandBuffer next) {
+  // moments stay on the device for `next`, which reads GetMomentBuffer; the
+  // buffer must already be reserved for every cell
+  if (momentCapacity == 0) {
+    throw std::runtime_error("moments must be reserved before chaining!");
+  }
+
+  UpdateRenderCommand(batches);
+  SubmitMoments(next).Wait();
+}
+
+
+VkCommandBuffer HeadlessVulkan::AllocateCommandBuffer() {
+  // released along with the pool
+  VkCommandBuffer cmdBuffer;
+  VkCommandBufferAllocateInfo cmdBufAllocateInfo =
+    vks::initializers::commandBufferAllocateInfo(commandPool,
+        VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1);
+  VK_CHECK_RESULT(vkAllocateCommandBuffers(device, &cmdBufAllocateInfo, &cmdBuffer))
+  return cmdBuffer;
+}
+
+
+void HeadlessVulkan::FreeCommandBuffer(VkCommandBuffer cmdBuffer) {
+  // instances outlive the solvers that allocate from them
+  vkFreeCommandBuffers(device, commandPool, 1, &cmdBuffer);
+}
+
+
+ComputePipeline HeadlessVulkan::CreateComputePipeline(const std::vector<std::string>& shaders, uint32_t bindings, uint32_t sets, uint32_t pushConstantSize) {
+  ComputePipeline compute;
+
+  std::vector<VkDescriptorSetLayoutBinding> setLayoutBindings;
+  for (uint32_t i = 0; i < bindings; i++) {
+    setLayoutBindings.push_back(vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, i));
+  }
+  VkDescriptorSetLayoutCreateInfo descriptorLayout =
+    vks::initializers::descriptorSetLayoutCreateInfo(setLayoutBindings);
+  VK_CHECK_RESULT(vkCreateDescriptorSetLayout(device, &descriptorLayout, nullptr, &compute.setLayout))
+
+  std::vector<VkDescriptorPoolSize> poolSizes = {
+    vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, bindings * sets)
+  };
+  VkDescriptorPoolCreateInfo poolInfo = vks::initializers::descriptorPoolCreateInfo(poolSizes, sets);
+  VK_CHECK_RESULT(vkCreateDescriptorPool(device, &poolInfo, nullptr, &compute.pool))
+
+  std::vector<VkDescriptorSetLayout> setLayouts(sets, compute.setLayout);
+  compute.sets.resize(sets);
+  VkDescriptorSetAllocateInfo allocInfo = vks::initializers::descriptorSetAllocateInfo(compute.pool, setLayouts.data(), sets);
+  VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &allocInfo, compute.sets.data()))
+
+  VkPushConstantRange pushConstantRange = vks::initializers::pushConstantRange(VK_SHADER_STAGE_COMPUTE_BIT, pushConstantSize, 0);
+  VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = vks::initializers::pipelineLayoutCreateInfo(&compute.setLayout, 1);
+  pipelineLayoutCreateInfo.pushConstantRangeCount = pushConstantSize > 0 ? 1 : 0;
+  pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+  VK_CHECK_RESULT(vkCreatePipelineLayout(device, &pipelineLayoutCreateInfo, nullptr, &compute.layout))
+
+  for (const std::string& shader : shaders) {
+    VkComputePipelineCreateInfo pipelineCreateInfo = vks::initializers::computePipelineCreateInfo(compute.layout);
+    pipelineCreateInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipelineCreateInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipelineCreateInfo.stage.pName = "main";
+    pipelineCreateInfo.stage.module = LoadShader(shader);
+    shaderModules.push_back(pipelineCreateInfo.stage.module);
+
+    VkPipeline computePipeline;
+    VK_CHECK_RESULT(vkCreateComputePipelines(device, pipelineCache, 1, &pipelineCreateInfo, nullptr, &computePipeline))
+    compute.pipelines.push_back(computePipeline);
+  }
+
+  return compute;
+}
+
+
+void HeadlessVulkan::UpdateComputeSet(ComputePipeline& compute, uint32_t set, const std::vector<VkBuffer>& buffers) {
+  std::vector<VkDescriptorBufferInfo> bufferInfos(buffers.size());
+  std::vector<VkWriteDescriptorSet> writes(buffers.size());
+
+  for (size_t i = 0; i < buffers.size(); i++) {
+    bufferInfos[i] = { buffers[i], 0, VK_WHOLE_SIZE };
+    writes[i] = vks::initializers::writeDescriptorSet(compute.sets[set], VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, i, &bufferInfos[i]);
+  }
+
+  vkUpdateDescriptorSets(device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+}
+
+
+void HeadlessVulkan::DestroyComputePipeline(ComputePipeline& compute) {
+  if (compute.setLayout == VK_NULL_HANDLE) {
+    return;
+  }
+
+  for (VkPipeline computePipeline : compute.pipelines) {
+    vkDestroyPipeline(device, computePipeline, nullptr);
+  }
+  vkDestroyPipelineLayout(device, compute.layout, nullptr);
+  vkDestroyDescriptorPool(device, compute.pool, nullptr);
+  vkDestroyDescriptorSetLayout(device, compute.setLayout, nullptr);
+  compute = ComputePipeline();
+}
+
+
+VkCommandBuffer HeadlessVulkan::BeginCommands() {
+  // a slot from the transfer ring, recorded by the caller and submitted with
+  // SubmitCommands, which waits for it to finish
+  pendingCommandBuffer = AcquireCommandBuffer(&DeviceTimings::compute);
+  return commandBuffers[pendingCommandBuffer];
+}
+
+
+void HeadlessVulkan::SubmitCommands() {
+  SubmitCommandsAsync().Wait();
+}
+
+
+DeviceSubmission HeadlessVulkan::SubmitCommandsAsync() {
+  VkCommandBuffer cmdBuffer = commandBuffers[pendingCommandBuffer];
+  EndTimestamp(cmdBuffer);
+  VK_CHECK_RESULT(vkEndCommandBuffer(cmdBuffer))
+  return SubmitWorkAsync({ cmdBuffer }, fences[pendingCommandBuffer]);
+}
+
+
+void HeadlessVulkan::CompletePending() {
+  // the equivalent of waiting for the device to go idle, without stalling
+  // other instances on the shared queue
+  for (auto& state : fenceStates) {
+    CompleteWork(state.first);
+  }
+}
+
+
+void HeadlessVulkan::ReleaseQueue() {
+  // work still in flight is charged to the queue it went out on
+  CompletePending();
+  if (queueHeld) {
+    context->Release(queueIndex);
+    queueHeld = false;
+  }
+}
+
+
+void HeadlessVulkan::AcquireQueue() {
+  if (!queueHeld) {
+    context->AcquireQueue(&queueIndex);
+    queueHeld = true;
+  }
 }
 
 
 void HeadlessVulkan::Cleanup() {
-  vkDestroyImageView(device, colorAttachment.view, nullptr);
-  vkDestroyImage(device, colorAttachment.image, nullptr);
-  vkFreeMemory(device, colorAttachment.memory, nullptr);
-  vkDestroyImageView(device, depthAttachment.view, nullptr);
-  vkDestroyImage(device, depthAttachment.image, nullptr);
-  vkFreeMemory(device, depthAttachment.memory, nullptr);
+  // nothing may still be in flight
+  CompletePending();
+
+  // compute only instances never create the render pass, the remaining null
+  // handles are ignored by vkDestroy*; buffers and attachments release their
+  // own memory
   vkDestroyRenderPass(device, renderPass, nullptr);
   vkDestroyFramebuffer(device, framebuffer, nullptr);
   vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
   vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
   vkDestroyPipeline(device, pipeline, nullptr);
-  vkDestroyPipelineCache(device, pipelineCache, nullptr);
+
+  if (densityBuffer.buffer != VK_NULL_HANDLE) {
+    vkDestroyPipeline(device, momentPipeline, nullptr);
+    vkDestroyPipelineLayout(device, momentPipelineLayout, nullptr);
+    vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+    vkDestroyDescriptorSetLayout(device, momentSetLayout, nullptr);
+    vkDestroySampler(device, labelSampler, nullptr);
+  }
+
+  for (VkFence fence : fences) {
+    vkDestroyFence(device, fence, nullptr);
+  }
+  vkDestroyFence(device, renderFence, nullptr);
+  for (VkFence fence : densityFences) {
+    vkDestroyFence(device, fence, nullptr);
+  }
+  for (const RenderTile& tile : tiles) {
+    for (const ReadbackBand& band : tile.bands) {
+      vkDestroyFence(device, band.fence, nullptr);
+    }
+  }
+  vkDestroyQueryPool(device, queryPool, nullptr);
+
+  // command buffers are released along with their pool
   vkDestroyCommandPool(device, commandPool, nullptr);
 
   for (auto shadermodule : shaderModules) {
     vkDestroyShaderModule(device, shadermodule, nullptr);
   }
 
-  vkDestroyDevice(device, nullptr);
-
-  vkDestroyInstance(instance, nullptr);
+  // the device itself belongs to the shared context, the queue is free for
+  // the next solver
+  if (context && queueHeld) {
+    context->Release(queueIndex);
+  }
 }
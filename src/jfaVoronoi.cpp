@@ -0,0 +1,162 @@
+#include "jfaVoronoi.h"
+#include <algorithm>
+#include <cstring>
+
+// BUFFER_INCREMENT in gpuVoronoi.h
+#define SITE_BUFFER_INCREMENT 1000
+
+JFAVoronoi::JFAVoronoi(int _width, int _height) {
+  width = _width;
+  height = _height;
+
+  computePipeline = new HeadlessVulkan(width, height);
+
+  const VkDeviceSize labelSize = static_cast<VkDeviceSize>(width) * height * sizeof(uint32_t);
+
+  for(int i = 0; i < 2; i++) {
+    labelBuffers[i] = computePipeline->CreateBuffer(
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        labelSize);
+  }
+
+  readbackBuffer = computePipeline->CreateHostBuffer(VK_BUFFER_USAGE_TRANSFER_DST_BIT, labelSize);
+  readbackData = static_cast<const unsigned char*>(readbackBuffer.Mapped());
+
+  // set i reads labelBuffers[i] and writes the other
+  jumpFlood = computePipeline->CreateComputePipeline({"jfaSeed.comp.spv", "jfaStep.comp.spv"}, 3, 2, 4 * sizeof(uint32_t));
+
+  GenerateSiteBuffer(1);
+}
+
+
+JFAVoronoi::~JFAVoronoi() {
+  // the buffers release their own memory
+  computePipeline->DestroyComputePipeline(jumpFlood);
+  delete computePipeline;
+}
+
+
+void JFAVoronoi::GenerateSiteBuffer(uint32_t len) {
+  if(len <= siteBufferSize) {
+    return;
+  }
+
+  siteBufferSize = std::max<uint32_t>(siteBufferSize, SITE_BUFFER_INCREMENT);
+  while(siteBufferSize < len) {
+    siteBufferSize *= 2;
+  }
+
+  // an async flood may still be reading the old buffer
+  computePipeline->CompletePending();
+  siteBuffer = computePipeline->CreateBuffer(
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+      siteBufferSize*sizeof(glm::vec2));
+  sites = static_cast<glm::vec2*>(siteBuffer.Mapped());
+
+  BindSets();
+}
+
+
+void JFAVoronoi::BindSets() {
+  computePipeline->UpdateComputeSet(jumpFlood, 0, {siteBuffer, labelBuffers[0], labelBuffers[1]});
+  computePipeline->UpdateComputeSet(jumpFlood, 1, {siteBuffer, labelBuffers[1], labelBuffers[0]});
+}
+
+
+uint32_t JFAVoronoi::Flood(uint32_t count) {
+  // recorded every call, it is only a handful of dispatches and the seed
+  // dispatch depends on the point count
+  VkCommandBuffer cmd = computePipeline->BeginCommands();
+
+  VkMemoryBarrier barrier = vks::initializers::memoryBarrier();
+  barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+  // seeds are written into labelBuffers[0], through set 1
+  vkCmdFillBuffer(cmd, labelBuffers[0], 0, VK_WHOLE_SIZE, LABEL_EMPTY);
+  vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+  uint32_t pushConstants[4] = { static_cast<uint32_t>(width), static_cast<uint32_t>(height), 0, count };
+
+  vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, jumpFlood.pipelines[0]);
+  vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, jumpFlood.layout, 0, 1, &jumpFlood.sets[1], 0, nullptr);
+  vkCmdPushConstants(cmd, jumpFlood.layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pushConstants), pushConstants);
+  vkCmdDispatch(cmd, (count + JFA_SEED_GROUP_SIZE - 1) / JFA_SEED_GROUP_SIZE, 1, 1);
+
+  // halving steps from half the larger dimension, then a final unit step
+  // which repairs most of the errors jump flooding leaves behind
+  std::vector<uint32_t> steps;
+  uint32_t step = 1;
+  while(step < static_cast<uint32_t>(std::max(width, height))) {
+    step *= 2;
+  }
+  for(step /= 2; step >= 1; step /= 2) {
+    steps.push_back(step);
+  }
+  steps.push_back(1);
+
+  vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, jumpFlood.pipelines[1]);
+
+  uint32_t current = 0;
+  for(uint32_t s : steps) {
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+    pushConstants[2] = s;
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, jumpFlood.layout, 0, 1, &jumpFlood.sets[current], 0, nullptr);
+    vkCmdPushConstants(cmd, jumpFlood.layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pushConstants), pushConstants);
+    vkCmdDispatch(cmd, (width + JFA_GROUP_SIZE - 1) / JFA_GROUP_SIZE, (height + JFA_GROUP_SIZE - 1) / JFA_GROUP_SIZE, 1);
+
+    current = 1 - current;
+  }
+
+  // copy the final labels into the mapped readback
+  barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+  vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+  VkBufferCopy copyRegion = {};
+  copyRegion.size = static_cast<VkDeviceSize>(width) * height * sizeof(uint32_t);
+  vkCmdCopyBuffer(cmd, labelBuffers[current], readbackBuffer, 1, &copyRegion);
+
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+  vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+  computePipeline->SubmitCommands();
+
+  computePipeline->InvalidateHostBuffer(readbackBuffer);
+
+  return current;
+}
+
+
+LabelMap JFAVoronoi::GetLabelMap(const std::vector<glm::vec2>& points) {
+  GenerateSiteBuffer(points.size());
+  computePipeline->CompletePending();
+  memcpy(sites, points.data(), points.size() * sizeof(glm::vec2));
+
+  Flood(points.size());
+
+  LabelMap view;
+  view.data = readbackData;
+  view.rowPitch = width * sizeof(uint32_t);
+  view.width = width;
+  view.height = height;
+  view.bytesPerLabel = sizeof(uint32_t);
+  return view;
+}
+
+
+cimg_library::CImg<uint32_t> JFAVoronoi::GetImage(const std::vector<glm::vec2>& points) {
+  LabelMap map = GetLabelMap(points);
+  cimg_library::CImg<uint32_t> out(width, height, 1, 1);
+
+  for(int y = 0; y < height; y++) {
+    memcpy(out.data(0, y), map.Row(y), width * sizeof(uint32_t));
+  }
+
+  return out;
+}
@@ -27,9 +27,49 @@ int main(int argc, char* argv[]) {
                        200000, glm::vec3(255, 255, 255),
                        1.5);
 
+  // optional third argument forces a Voronoi engine by name, or "resident"
+  // for the device resident loop; "auto" or nothing benchmarks them all
+  if(argc > 3 && std::string(argv[3]) == "resident") {
+    stippleParams.engine = EngineType::Raster;
+    stippleParams.resident = true;
+  }
+  else if(argc > 3 && std::string(argv[3]) != "auto") {
+    const EngineEntry* entry = FindEngine(argv[3]);
+    if(entry == nullptr) {
+      std::cerr << "Unknown engine " << argv[3] << ", expected auto, resident";
+      for(const EngineEntry& engine : GetEngines()) {
+        std::cerr << ", " << engine.name;
+      }
+      std::cerr << std::endl;
+      return -1;
+    }
+
+    stippleParams.engine = entry->type;
+    stippleParams.mode = entry->mode;
+  }
+
+  // optional fourth argument is the device policy, e.g. "discrete" or
+  // "cpu,devices=4,report"
+  if(argc > 4) {
+    VulkanContext::SetPolicy(DevicePolicy::Parse(argv[4]));
+  }
+
   StippleImage stipple(*img1, stippleParams);
   stipple.Solve();
-  stipple.DrawImage().save(argv[2]);
+
+  // optional fifth argument scales the output, drawn on the device; hosts
+  // without one draw at the image's size
+  if(argc > 5 && !VulkanDeviceAvailable()) {
+    std::cerr << "No Vulkan device to render on, drawing unscaled" << std::endl;
+    stipple.DrawImage().save(argv[2]);
+  }
+  else if(argc > 5) {
+    const float scale = std::stof(argv[5]);
+    stipple.RenderImage(static_cast<int>(img1->width() * scale), static_cast<int>(img1->height() * scale)).save(argv[2]);
+  }
+  else {
+    stipple.DrawImage().save(argv[2]);
+  }
 
 
   delete img1;
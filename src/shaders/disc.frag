@@ -0,0 +1,13 @@
+#version 450 core
+layout(location = 0) in vec4 VertColor;
+layout(location = 1) in vec2 PixelOffset;
+layout(location = 2) flat in float Radius;
+
+layout(location = 0) out vec4 fragColor;
+
+void main()
+{
+  // coverage of the pixel by the disc, linear across the last pixel
+  float coverage = clamp(Radius + 0.5f - length(PixelOffset), 0.0f, 1.0f);
+  fragColor = vec4(VertColor.rgb, VertColor.a * coverage);
+}
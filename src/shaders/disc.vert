@@ -0,0 +1,27 @@
+#version 450 core
+layout(location = 0) in vec3 VertPosition; // quad corner, one pixel from the centre in device units
+layout(location = 1) in vec3 DiscInstance; // xy position, z radius in pixels
+layout(location = 2) in vec4 DiscColor;
+
+layout(location = 0) out vec4 VertColor;
+layout(location = 1) out vec2 PixelOffset;
+layout(location = 2) flat out float Radius;
+
+layout(push_constant) uniform Tile {
+  vec2 scale; // image device coordinates onto the tile being rendered
+  vec2 offset;
+};
+
+void main()
+{
+  VertColor = DiscColor;
+  Radius = DiscInstance.z;
+
+  // a pixel past the rim leaves room for the antialiased edge; the offset
+  // in pixels interpolates exactly across the quad
+  float reach = DiscInstance.z + 1.0f;
+  PixelOffset = sign(VertPosition.xy) * reach;
+
+  vec2 image = VertPosition.xy * reach + 2.0f * DiscInstance.xy - 1.0f;
+  gl_Position = vec4(image * scale + offset, 0.0f, 1.0f);
+}
@@ -0,0 +1,14 @@
+#version 450 core
+layout(location = 0) flat in uint VertLabel;
+layout(location = 1) in vec2 DepthOffset;
+
+layout(location = 0) out uint fragLabel;
+
+// the quad is rasterised at depth zero, so written depth only ever grows
+layout(depth_greater) out float gl_FragDepth;
+
+void main()
+{
+  fragLabel = VertLabel;
+  gl_FragDepth = min(length(DepthOffset), 1.0f);
+}
@@ -0,0 +1,34 @@
+#version 450 core
+#ifdef LAYERED
+#extension GL_ARB_shader_viewport_layer_array : require
+#endif
+layout(location = 0) in vec3 VertPosition;
+layout(location = 1) in vec3 ConeInstance; // xy position, z radius
+layout(location = 2) in uint ConeLabel;
+#ifdef LAYERED
+layout(location = 3) in uint ConeLayer; // the point set, one per framebuffer layer
+#endif
+
+layout(location = 0) flat out uint VertLabel;
+layout(location = 1) out vec2 DepthOffset;
+
+layout(push_constant) uniform Tile {
+  vec2 scale; // image device coordinates onto the tile being rendered
+  vec2 offset;
+};
+
+void main()
+{
+  VertLabel = ConeLabel;
+#ifdef LAYERED
+  gl_Layer = int(ConeLayer);
+#endif
+
+  // offset from the site in depth units, aspect corrected; interpolates
+  // exactly across the quad so the fragment distance is exact
+  DepthOffset = sign(VertPosition.xy) * VertPosition.z * ConeInstance.z;
+
+  vec2 corner = VertPosition.xy * ConeInstance.z;
+  vec2 image = vec2(corner.x + 2.0f*ConeInstance.x - 1.0f, corner.y + 2.0f*ConeInstance.y - 1.0f);
+  gl_Position = vec4(image * scale + offset, 0.0f, 1.0f);
+}
@@ -1,9 +1,9 @@
-#version 410 core
-layout(location = 0) in vec3 VertColor;
+#version 450 core
+layout(location = 0) flat in uint VertLabel;
 
-layout(location = 0) out vec4 fragColor;
+layout(location = 0) out uint fragLabel;
 
 void main()
 {
-  fragColor = vec4(VertColor, 1);
+  fragLabel = VertLabel;
 }
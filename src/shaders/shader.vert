@@ -1,14 +1,33 @@
-#version 410 core
+#version 450 core
+#ifdef LAYERED
+#extension GL_ARB_shader_viewport_layer_array : require
+#endif
 layout(location = 0) in vec3 VertPosition;
-layout(location = 1) in vec2 ConePosition;
-layout(location = 2) in vec3 ConeColor;
+layout(location = 1) in vec3 ConeInstance; // xy position, z radius
+layout(location = 2) in uint ConeLabel;
+#ifdef LAYERED
+layout(location = 3) in uint ConeLayer; // the point set, one per framebuffer layer
+#endif
 
-layout(location = 0) out vec3 VertColor;
+layout(location = 0) flat out uint VertLabel;
+
+layout(push_constant) uniform Tile {
+  vec2 scale; // image device coordinates onto the tile being rendered
+  vec2 offset;
+};
 
 void main()
 {
-  VertColor = ConeColor;
-  gl_Position = vec4(VertPosition.x + 2.0f*ConePosition.x - 1.0f, VertPosition.y + 2.0f*ConePosition.y - 1.0f, VertPosition.z, 1.0f);
+  // instances are grouped by level of detail, so the stipple index travels with the instance
+  VertLabel = ConeLabel;
+#ifdef LAYERED
+  gl_Layer = int(ConeLayer);
+#endif
+
+  // the unit cone is scaled to the instance's reach, depth included
+  vec3 cone = VertPosition * ConeInstance.z;
+  vec2 image = vec2(cone.x + 2.0f*ConeInstance.x - 1.0f, cone.y + 2.0f*ConeInstance.y - 1.0f);
+  gl_Position = vec4(image * scale + offset, cone.z, 1.0f);
 }
 
 //# const float height = 1.99f;
@@ -1,4 +1,5 @@
 #include "stipples.h"
+#include <iomanip>
 
 StippleImage::StippleImage(const CImg<unsigned char>& _img, const Params& _params) : params(_params) {
     std::random_device rd;
@@ -7,9 +8,6 @@ StippleImage::StippleImage(const CImg<unsigned char>& _img, const Params& _param
 
     img = CImg<unsigned char>(_img.width(), _img.height(), 1, 1, 0);
 
-    voronoiSolver = new GPUVoronoi(img.width(), img.height());
-    //voronoiSolver = new GPUVoronoi(img.width(), img.height());
-
     if(_img.spectrum() > 1) {
         cimg_forXY(_img,x,y) {
 
@@ -27,6 +25,41 @@ StippleImage::StippleImage(const CImg<unsigned char>& _img, const Params& _param
     else {
         img.assign(_img);
     }
+
+    // moving average downsample, local detail is irrelevant to cone reach
+    densityMap = img.get_resize(std::max(1, img.width() / DENSITY_MAP_SCALE),
+                                std::max(1, img.height() / DENSITY_MAP_SCALE), 1, 1, 2);
+
+    // a forced engine is built as asked, otherwise the fastest one here
+    const EngineEntry* entry = params.engine == EngineType::Auto ? &AutoselectEngine() : FindEngine(params.engine, params.mode);
+    if(entry == nullptr) {
+        throw std::runtime_error("no such Voronoi engine!");
+    }
+    voronoiSolver = entry->create(img.width(), img.height(), params.maxPoints);
+
+    // moments are reduced by the engine when it can, against a density
+    // handed over once here
+    if(voronoiSolver->SupportsMoments()) {
+        voronoiSolver->SetDensity(img);
+    }
+
+    // random stipples share the image evenly
+    cellAreas.assign(stipples.size(), static_cast<float>(img.width()) * img.height() / std::max<size_t>(stipples.size(), 1));
+}
+
+// ends an iteration's log line with where its device time went
+static void LogTimings(const DeviceTimings& timings) {
+    if(timings.Timed()) {
+        std::cout << std::fixed << std::setprecision(2)
+                  << " render: " << timings.render << "ms"
+                  << " readback: " << timings.readback << "ms"
+                  << " moments: " << timings.moments << "ms"
+                  << " upload: " << timings.upload << "ms"
+                  << " compute: " << timings.compute << "ms"
+                  << " wait: " << timings.wait << "ms"
+                  << std::defaultfloat;
+    }
+    std::cout << std::endl;
 }
 
 glm::vec2 ClampPoint(glm::vec2 pt) {
@@ -36,14 +69,39 @@ glm::vec2 ClampPoint(glm::vec2 pt) {
 void StippleImage::Iterate(float hysteresis) {
     std::vector<glm::vec2> pts = GetCenters(this->stipples);
 
-    // TODO: factor out construction, image is always the same size
-    cimg_library::CImg<unsigned char> map = voronoiSolver->GetImage(pts);
+    std::vector<float> radii = GetConeRadii(hysteresis);
+    std::vector<VoronoiCell> voronoi;
 
-    std::vector<VoronoiCell> voronoi = GetVoronoiCells(map, img, pts);
+    if(voronoiSolver->SupportsMoments()) {
+        // only per cell moments come back from the device
+        voronoi = voronoiSolver->GetCells(pts, radii);
+
+#ifdef DEBUG
+        // compare against the host reduction of the same diagram
+        std::vector<VoronoiCell> reference = GetVoronoiCells(voronoiSolver->GetLabelMap(pts, radii), img, pts);
+        float maxError = 0.0f;
+        for(int i : range(voronoi.size())) {
+            if(reference[i].m00 <= 0.0f) continue;
+            maxError = std::max(maxError, glm::length(voronoi[i].centroid - reference[i].centroid));
+        }
+        std::cout << "moment centroid error: " << maxError << std::endl;
+#endif
+    }
+    else {
+        // straight from the solver's mapped readback, each band is
+        // accumulated while the ones below it are still being copied
+        voronoi.assign(pts.size(), VoronoiCell());
+        voronoiSolver->StreamLabelMap(pts, radii, [&](const LabelMap& map, const LabelRegion& region) {
+            AccumulateVoronoiCells(voronoi, map, img, region);
+        });
+        FinalizeVoronoiCells(voronoi, img.width(), img.height());
+    }
 
     std::vector<Point> newPoints;
+    std::vector<float> newAreas;
     // TODO: would heuristic be valuable?
     newPoints.reserve(stipples.size()*1.2);
+    newAreas.reserve(stipples.size()*1.2);
 
     glm::vec2 center;
     glm::vec3 color;
@@ -65,6 +123,7 @@ void StippleImage::Iterate(float hysteresis) {
             // keep cell
             center = ClampPoint(voronoi[i].centroid);
             newPoints.emplace_back(center, size, color);
+            newAreas.push_back(voronoi[i].area);
         }
         else {
 
@@ -77,14 +136,97 @@ void StippleImage::Iterate(float hysteresis) {
             center = this->Jitter(voronoi[i].centroid - axis);
             newPoints.emplace_back(Point(ClampPoint(center), size, color));
 
+            // children keep the parent's area, erring towards larger cones
+            newAreas.push_back(voronoi[i].area);
+            newAreas.push_back(voronoi[i].area);
+
             this->changes++;
         }
     }
     this->iterations++;
-    std::cout << "iteration: " << this->iterations << " changes: " << this->changes << " stipples: " << newPoints.size() << std::endl;
+    std::cout << "iteration: " << this->iterations << " changes: " << this->changes << " stipples: " << newPoints.size();
+    LogTimings(voronoiSolver->TakeTimings());
 
     // TODO: memory copy problem?
     this->stipples = newPoints;
+    this->cellAreas = newAreas;
+}
+
+
+std::vector<float> StippleImage::GetConeRadii(float hysteresis) {
+    // a cell is split once its mass passes the upper bound, so in a region of
+    // uniform density no surviving cell is larger than bound / density; cones
+    // reach a margin past that, or past the cell's last area if it was larger
+    std::vector<float> radii;
+    radii.reserve(stipples.size());
+
+    const float bound = GetUpperSplitBound(params.pointSize, hysteresis);
+
+    for(size_t i = 0; i < stipples.size(); i++) {
+        radii.push_back(GetConeRadius(stipples[i].pos, bound, cellAreas[i]));
+    }
+
+    return radii;
+}
+
+
+float StippleImage::GetConeRadius(glm::vec2 pos, float bound, float area) {
+    float intensity = densityMap.linear_atXY(pos.x * (densityMap.width() - 1), pos.y * (densityMap.height() - 1));
+    float density = std::max(1.0f - intensity / 255.0f, 1.0f / 255.0f);
+
+    area = std::max(bound / density, area);
+    return CONE_RADIUS_MARGIN * std::sqrt(area / PI);
+}
+
+
+const EngineEntry& StippleImage::AutoselectEngine() {
+    // the stipple count the image settles towards, one cell's target mass
+    // per stipple, is where the solve spends most of its iterations
+    const float mass = PI * params.pointSize * params.pointSize * params.multiplier;
+    double total = 0.0;
+    cimg_forXY(img, x, y) {
+        total += Density(img(x, y));
+    }
+    const int expected = std::clamp(static_cast<int>(total / mass), std::max(params.count, 1), std::max(params.maxPoints, 1));
+
+    // engines are timed on a centre crop at full resolution, holding its
+    // share of the stipples, so cells are the sizes they will be
+    const int cropWidth = std::min(img.width(), ENGINE_BENCHMARK_SIZE);
+    const int cropHeight = std::min(img.height(), ENGINE_BENCHMARK_SIZE);
+    const int x0 = (img.width() - cropWidth) / 2;
+    const int y0 = (img.height() - cropHeight) / 2;
+    CImg<unsigned char> crop = img.get_crop(x0, y0, x0 + cropWidth - 1, y0 + cropHeight - 1);
+
+    // spread by density, rather than as the random start is
+    std::vector<float> weights;
+    weights.reserve(crop.size());
+    double cropTotal = 0.0;
+    cimg_forXY(crop, x, y) {
+        weights.push_back(Density(crop(x, y)));
+        cropTotal += weights.back();
+    }
+    const int count = std::max(1, static_cast<int>(expected * cropTotal / total));
+
+    std::discrete_distribution<int> sample(weights.begin(), weights.end());
+    std::uniform_real_distribution<float> offset(0.0f, 1.0f);
+    const float bound = GetUpperSplitBound(params.pointSize, GetHysteresis());
+
+    std::vector<glm::vec2> points;
+    std::vector<float> radii;
+    points.reserve(count);
+    radii.reserve(count);
+
+    for(int i = 0; i < count; i++) {
+        const int s = sample(generator);
+        const glm::vec2 pixel(s % cropWidth + offset(generator), s / cropWidth + offset(generator));
+
+        // radii are in pixels, so the same at either scale
+        points.push_back(ClampPoint(pixel / glm::vec2(cropWidth, cropHeight)));
+        radii.push_back(GetConeRadius(ClampPoint((pixel + glm::vec2(x0, y0)) / glm::vec2(img.width(), img.height())), bound, 0.0f));
+    }
+
+    std::cout << "timing engines on " << cropWidth << "x" << cropHeight << " with " << count << " of " << expected << " stipples" << std::endl;
+    return SelectEngine(crop, points, radii, img.width(), img.height());
 }
 
 
@@ -114,6 +256,10 @@ std::vector<Point> StippleImage::GetRandomStipples(const int& count) {
 
 
 bool StippleImage::Solve() {
+    if(params.resident && voronoiSolver->SupportsResident()) {
+        return SolveResident();
+    }
+
     while(!this->IsDone() && !this->IsError()) {
         float hysteresis = this->GetHysteresis();
         Iterate(hysteresis);
@@ -123,6 +269,39 @@ bool StippleImage::Solve() {
 }
 
 
+bool StippleImage::SolveResident() {
+    // the whole loop stays on the device, each iteration only reports the
+    // point count and the number of changes
+    voronoiSolver->BeginResident(GetCenters(this->stipples), this->params.maxPoints);
+
+    uint32_t count = this->stipples.size();
+    uint32_t changes;
+
+    while(!this->IsDone() && this->iterations < this->params.maxIterations
+          && count <= static_cast<uint32_t>(this->params.maxPoints)) {
+        float hysteresis = this->GetHysteresis();
+        float size = this->params.pointSize;
+
+        ResidentBounds bounds = {GetLowerSplitBound(size, hysteresis), GetUpperSplitBound(size, hysteresis), this->params.jitter, CONE_RADIUS_MARGIN};
+        voronoiSolver->IterateResident(bounds, &count, &changes);
+
+        this->changes = changes;
+        this->iterations++;
+        std::cout << "iteration: " << this->iterations << " changes: " << this->changes << " stipples: " << count;
+        LogTimings(voronoiSolver->TakeTimings());
+    }
+
+    this->stipples.clear();
+    for(glm::vec2 pt : voronoiSolver->ReadPoints()) {
+        this->stipples.emplace_back(pt, this->params.pointSize, glm::vec3(0, 0, 0));
+    }
+
+    // points past maxPoints are dropped on the device, so check the request
+    return this->iterations < this->params.maxIterations
+           && count <= static_cast<uint32_t>(this->params.maxPoints);
+}
+
+
 bool StippleImage::IsDone() const {
     return (this->changes == 0);
 }
@@ -177,3 +356,19 @@ CImg<unsigned char> StippleImage::DrawImage() {
 
     return img;
 }
+
+
+CImg<unsigned char> StippleImage::RenderImage(int width, int height) {
+    // the same picture as DrawImage drawn on the device at any size; stipple
+    // sizes are in pixels of the source image
+    const float scale = static_cast<float>(width) / this->img.width();
+
+    std::vector<DiscInstance> discs;
+    discs.reserve(this->stipples.size());
+    for(const Point& pt : this->stipples) {
+        discs.push_back({pt.pos, pt.size * scale, PackColor(pt.color)});
+    }
+
+    DiscRenderer renderer(width, height);
+    return renderer.Render(discs, this->params.bgdColor);
+}
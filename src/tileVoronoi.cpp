@@ -0,0 +1,291 @@
+#include "tileVoronoi.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TILE_X86
+#endif
+
+// each kernel fills a TILE_SIZE square of labels from the candidates, which
+// are relative to the tile's corner; distances are a multiply and an add
+// in single precision with no fused forms, and a candidate only wins
+// when strictly nearer, so every kernel agrees with the scalar one
+
+static void ShadeTileScalar(const TileCandidates& candidates, uint32_t* tile) {
+  for(int y = 0; y < TILE_SIZE; y++) {
+    for(int x = 0; x < TILE_SIZE; x++) {
+      const float px = x + 0.5f;
+      const float py = y + 0.5f;
+
+      float best = std::numeric_limits<float>::infinity();
+      uint32_t label = LABEL_EMPTY;
+      for(size_t i = 0; i < candidates.labels.size(); i++) {
+        const float dx = px - candidates.x[i];
+        const float dy = py - candidates.y[i];
+        const float distance = dx * dx + dy * dy;
+        if(distance < best) {
+          best = distance;
+          label = candidates.labels[i];
+        }
+      }
+
+      tile[y * TILE_SIZE + x] = label;
+    }
+  }
+}
+
+
+#ifdef TILE_X86
+__attribute__((target("avx2")))
+static void ShadeTileAVX2(const TileCandidates& candidates, uint32_t* tile) {
+  const __m256 offsets = _mm256_setr_ps(0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f);
+
+  for(int y = 0; y < TILE_SIZE; y++) {
+    const __m256 py = _mm256_set1_ps(y + 0.5f);
+    const __m256 px[2] = {offsets, _mm256_add_ps(offsets, _mm256_set1_ps(8.0f))};
+
+    __m256 best[2] = {_mm256_set1_ps(std::numeric_limits<float>::infinity()), _mm256_set1_ps(std::numeric_limits<float>::infinity())};
+    __m256i label[2] = {_mm256_set1_epi32(LABEL_EMPTY), _mm256_set1_epi32(LABEL_EMPTY)};
+
+    for(size_t i = 0; i < candidates.labels.size(); i++) {
+      const __m256 dy = _mm256_sub_ps(py, _mm256_set1_ps(candidates.y[i]));
+      const __m256 dy2 = _mm256_mul_ps(dy, dy);
+      const __m256 sx = _mm256_set1_ps(candidates.x[i]);
+      const __m256i site = _mm256_set1_epi32(candidates.labels[i]);
+
+      for(int half = 0; half < 2; half++) {
+        const __m256 dx = _mm256_sub_ps(px[half], sx);
+        const __m256 distance = _mm256_add_ps(_mm256_mul_ps(dx, dx), dy2);
+        const __m256 nearer = _mm256_cmp_ps(distance, best[half], _CMP_LT_OQ);
+
+        best[half] = _mm256_blendv_ps(best[half], distance, nearer);
+        label[half] = _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(label[half]), _mm256_castsi256_ps(site), nearer));
+      }
+    }
+
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(tile + y * TILE_SIZE), label[0]);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(tile + y * TILE_SIZE + 8), label[1]);
+  }
+}
+
+
+__attribute__((target("avx512f")))
+static void ShadeTileAVX512(const TileCandidates& candidates, uint32_t* tile) {
+  const __m512 px = _mm512_setr_ps(0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f,
+                                   8.5f, 9.5f, 10.5f, 11.5f, 12.5f, 13.5f, 14.5f, 15.5f);
+
+  for(int y = 0; y < TILE_SIZE; y++) {
+    const __m512 py = _mm512_set1_ps(y + 0.5f);
+
+    __m512 best = _mm512_set1_ps(std::numeric_limits<float>::infinity());
+    __m512i label = _mm512_set1_epi32(LABEL_EMPTY);
+
+    for(size_t i = 0; i < candidates.labels.size(); i++) {
+      const __m512 dx = _mm512_sub_ps(px, _mm512_set1_ps(candidates.x[i]));
+      const __m512 dy = _mm512_sub_ps(py, _mm512_set1_ps(candidates.y[i]));
+      const __m512 distance = _mm512_add_ps(_mm512_mul_ps(dx, dx), _mm512_mul_ps(dy, dy));
+      const __mmask16 nearer = _mm512_cmp_ps_mask(distance, best, _CMP_LT_OQ);
+
+      best = _mm512_mask_mov_ps(best, nearer, distance);
+      label = _mm512_mask_mov_epi32(label, nearer, _mm512_set1_epi32(candidates.labels[i]));
+    }
+
+    _mm512_storeu_si512(tile + y * TILE_SIZE, label);
+  }
+}
+#endif
+
+static_assert(TILE_SIZE == 16, "the vector kernels shade rows of 16 pixels");
+
+
+TileVoronoi::TileVoronoi(int _width, int _height, uint32_t threads) : workers(threads) {
+  width = _width;
+  height = _height;
+  tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+  tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+  labels.resize(static_cast<size_t>(width) * height);
+
+  kernel = ShadeTileScalar;
+#ifdef TILE_X86
+  if(__builtin_cpu_supports("avx512f")) {
+    kernel = ShadeTileAVX512;
+  }
+  else if(__builtin_cpu_supports("avx2")) {
+    kernel = ShadeTileAVX2;
+  }
+#endif
+}
+
+
+const char* TileVoronoi::KernelName() const {
+#ifdef TILE_X86
+  if(kernel == ShadeTileAVX512) return "avx512";
+  if(kernel == ShadeTileAVX2) return "avx2";
+#endif
+  return "scalar";
+}
+
+
+bool TileVoronoi::SetKernel(const char* name) {
+  if(strcmp(name, "scalar") == 0) {
+    kernel = ShadeTileScalar;
+    return true;
+  }
+
+#ifdef TILE_X86
+  if(strcmp(name, "avx512") == 0 && __builtin_cpu_supports("avx512f")) {
+    kernel = ShadeTileAVX512;
+    return true;
+  }
+  if(strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2")) {
+    kernel = ShadeTileAVX2;
+    return true;
+  }
+#endif
+
+  return false;
+}
+
+
+void TileVoronoi::BuildGrid(const std::vector<glm::vec2>& points) {
+  sites.resize(points.size());
+  for(size_t i = 0; i < points.size(); i++) {
+    sites[i] = points[i] * glm::vec2(width, height);
+  }
+
+  // square bins holding a couple of sites each on average
+  binSize = std::sqrt(static_cast<float>(width) * height * TILE_SITES_PER_BIN / std::max<size_t>(points.size(), 1));
+  binsX = std::max(1, static_cast<int>(std::ceil(width / binSize)));
+  binsY = std::max(1, static_cast<int>(std::ceil(height / binSize)));
+
+  std::vector<uint32_t> bins(sites.size());
+  binStarts.assign(static_cast<size_t>(binsX) * binsY + 1, 0);
+  for(size_t i = 0; i < sites.size(); i++) {
+    const int bx = std::clamp(static_cast<int>(sites[i].x / binSize), 0, binsX - 1);
+    const int by = std::clamp(static_cast<int>(sites[i].y / binSize), 0, binsY - 1);
+    bins[i] = by * binsX + bx;
+    binStarts[bins[i] + 1]++;
+  }
+
+  for(size_t b = 1; b < binStarts.size(); b++) {
+    binStarts[b] += binStarts[b - 1];
+  }
+
+  std::vector<uint32_t> next(binStarts.begin(), binStarts.end() - 1);
+  binSites.resize(sites.size());
+  for(size_t i = 0; i < sites.size(); i++) {
+    binSites[next[bins[i]]++] = i;
+  }
+}
+
+
+void TileVoronoi::GatherCandidates(uint32_t tile, TileCandidates& candidates) {
+  const glm::vec2 corner = glm::vec2(tile % tilesX, tile / tilesX) * float(TILE_SIZE);
+  const glm::vec2 centre = corner + 0.5f * TILE_SIZE;
+  const float halfDiagonal = 0.5f * std::sqrt(2.0f) * TILE_SIZE;
+
+  const int bx = std::clamp(static_cast<int>(centre.x / binSize), 0, binsX - 1);
+  const int by = std::clamp(static_cast<int>(centre.y / binSize), 0, binsY - 1);
+
+  // grow a box of bins until it holds a site; no pixel of the tile is then
+  // further than its distance plus the half diagonal from a site, so no
+  // site further than that plus the half diagonal again can win a pixel
+  float nearest = std::numeric_limits<float>::infinity();
+  for(int ring = 0; ring <= std::max(binsX, binsY) && nearest == std::numeric_limits<float>::infinity(); ring++) {
+    for(int y = std::max(by - ring, 0); y <= std::min(by + ring, binsY - 1); y++) {
+      for(int x = std::max(bx - ring, 0); x <= std::min(bx + ring, binsX - 1); x++) {
+        const uint32_t bin = y * binsX + x;
+        for(uint32_t k = binStarts[bin]; k < binStarts[bin + 1]; k++) {
+          nearest = std::min(nearest, glm::distance(sites[binSites[k]], centre));
+        }
+      }
+    }
+  }
+
+  candidates.x.clear();
+  candidates.y.clear();
+  candidates.labels.clear();
+  if(nearest == std::numeric_limits<float>::infinity()) {
+    return;
+  }
+
+  // a little slack so rounding never drops a site on the boundary
+  const float reach = nearest + 2.0f * halfDiagonal + 1.0f;
+  const int x0 = std::clamp(static_cast<int>((centre.x - reach) / binSize), 0, binsX - 1);
+  const int x1 = std::clamp(static_cast<int>((centre.x + reach) / binSize), 0, binsX - 1);
+  const int y0 = std::clamp(static_cast<int>((centre.y - reach) / binSize), 0, binsY - 1);
+  const int y1 = std::clamp(static_cast<int>((centre.y + reach) / binSize), 0, binsY - 1);
+
+  for(int y = y0; y <= y1; y++) {
+    for(int x = x0; x <= x1; x++) {
+      const uint32_t bin = y * binsX + x;
+      for(uint32_t k = binStarts[bin]; k < binStarts[bin + 1]; k++) {
+        if(glm::distance(sites[binSites[k]], centre) <= reach) {
+          candidates.labels.push_back(binSites[k]);
+        }
+      }
+    }
+  }
+
+  // index order, so the lowest index wins a tie as in the other engines
+  std::sort(candidates.labels.begin(), candidates.labels.end());
+  for(uint32_t site : candidates.labels) {
+    candidates.x.push_back(sites[site].x - corner.x);
+    candidates.y.push_back(sites[site].y - corner.y);
+  }
+}
+
+
+void TileVoronoi::ShadeTile(uint32_t tile, TileCandidates& candidates) {
+  GatherCandidates(tile, candidates);
+
+  uint32_t shaded[TILE_SIZE * TILE_SIZE];
+  kernel(candidates, shaded);
+
+  // tiles on the right and bottom edges hang over the image
+  const int x0 = (tile % tilesX) * TILE_SIZE;
+  const int y0 = (tile / tilesX) * TILE_SIZE;
+  const int columns = std::min(TILE_SIZE, width - x0);
+  const int rows = std::min(TILE_SIZE, height - y0);
+
+  for(int y = 0; y < rows; y++) {
+    memcpy(&labels[static_cast<size_t>(y0 + y) * width + x0], shaded + y * TILE_SIZE, columns * sizeof(uint32_t));
+  }
+}
+
+
+LabelMap TileVoronoi::GetLabelMap(const std::vector<glm::vec2>& points) {
+  BuildGrid(points);
+
+  // a row of tiles per task, so candidate storage is reused along it
+  workers.ParallelFor(tilesY, [&](uint32_t row) {
+    TileCandidates candidates;
+    for(uint32_t x = 0; x < tilesX; x++) {
+      ShadeTile(row * tilesX + x, candidates);
+    }
+  });
+
+  // valid until the next call overwrites the buffer
+  LabelMap view;
+  view.data = reinterpret_cast<const unsigned char*>(labels.data());
+  view.rowPitch = width * sizeof(uint32_t);
+  view.width = width;
+  view.height = height;
+  view.bytesPerLabel = sizeof(uint32_t);
+  return view;
+}
+
+
+cimg_library::CImg<uint32_t> TileVoronoi::GetImage(const std::vector<glm::vec2>& points) {
+  LabelMap map = GetLabelMap(points);
+  cimg_library::CImg<uint32_t> out(width, height, 1, 1);
+
+  for(int y = 0; y < height; y++) {
+    memcpy(out.data(0, y), map.Row(y), width * sizeof(uint32_t));
+  }
+
+  return out;
+}
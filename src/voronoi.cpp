@@ -1,18 +1,17 @@
 #include "voronoi.h"
 
-std::vector<VoronoiCell> GetVoronoiCells(const CImg<unsigned char>& map, const CImg<unsigned char>& img, const std::vector<glm::vec2> pts) {
+std::vector<VoronoiCell> GetVoronoiCells(const CImg<uint32_t>& map, const CImg<unsigned char>& img, const std::vector<glm::vec2>& pts) {
     std::vector<VoronoiCell> voronoi(pts.size());
 
     float density;
     VoronoiCell* cell;
 
-    cimg_library::CImg<unsigned char> error = cimg_library::CImg<unsigned char>(map.width(), map.height(), 1, 3);
-
     cimg_forXY(map, _x, _y) {
-            uint32_t index = DecodeColor(map(_x,_y,0), map(_x,_y,1), map(_x,_y,2));
+            uint32_t index = map(_x, _y);
+            if(index >= voronoi.size()) continue;
 
             cell = &voronoi[index];
-            density = std::max(1.0f - img(_x, _y) / 255.0f, std::numeric_limits<float>::epsilon());
+            density = Density(img(_x, _y));
 
             cell->area++;
             cell->m00 += density;
@@ -25,6 +24,69 @@ std::vector<VoronoiCell> GetVoronoiCells(const CImg<unsigned char>& map, const C
             cell->m02 += _y * _y * density;
     }
 
+    FinalizeVoronoiCells(voronoi, img.width(), img.height());
+    return voronoi;
+}
+
+template <typename Label>
+void AccumulateLabels(std::vector<VoronoiCell>& voronoi, const LabelMap& map, const CImg<unsigned char>& img, const LabelRegion& region) {
+    // density only depends on the 8 bit intensity
+    float densities[256];
+    for(int i = 0; i < 256; i++) {
+        densities[i] = Density(i);
+    }
+
+    float density;
+    VoronoiCell* cell;
+
+    // walk the mapped rows directly, uncovered pixels carry an all ones label
+    // which always falls outside the cell range
+    for(int y = region.y; y < region.y + region.height; y++) {
+        const Label* labels = reinterpret_cast<const Label*>(map.Row(y));
+        const unsigned char* intensity = img.data(0, y);
+
+        for(int x = region.x; x < region.x + region.width; x++) {
+            uint32_t index = labels[x];
+            if(index >= voronoi.size()) continue;
+
+            cell = &voronoi[index];
+            density = densities[intensity[x]];
+
+            cell->area++;
+            cell->m00 += density;
+
+            cell->m10 += x * density;
+            cell->m01 += y * density;
+            cell->m11 += x * y * density;
+
+            cell->m20 += x * x * density;
+            cell->m02 += y * y * density;
+        }
+    }
+}
+
+std::vector<VoronoiCell> GetVoronoiCells(const LabelMap& map, const CImg<unsigned char>& img, const std::vector<glm::vec2>& pts) {
+    std::vector<VoronoiCell> voronoi(pts.size());
+
+    LabelRegion region;
+    region.width = map.width;
+    region.height = map.height;
+    AccumulateVoronoiCells(voronoi, map, img, region);
+
+    FinalizeVoronoiCells(voronoi, img.width(), img.height());
+    return voronoi;
+}
+
+void AccumulateVoronoiCells(std::vector<VoronoiCell>& voronoi, const LabelMap& map, const CImg<unsigned char>& img, const LabelRegion& region) {
+    if(map.bytesPerLabel == 2) {
+        AccumulateLabels<uint16_t>(voronoi, map, img, region);
+    }
+    else {
+        AccumulateLabels<uint32_t>(voronoi, map, img, region);
+    }
+}
+
+void FinalizeVoronoiCells(std::vector<VoronoiCell>& voronoi, int width, int height) {
     float a, b, c;
 
     for(int i : range(voronoi.size())) {
@@ -40,9 +102,7 @@ std::vector<VoronoiCell> GetVoronoiCells(const CImg<unsigned char>& map, const C
         c = voronoi[i].m02 / voronoi[i].m00 - voronoi[i].centroid.y * voronoi[i].centroid.y;
         voronoi[i].angle = std::atan2(b, a - c) / 2.0f;
 
-        voronoi[i].centroid[0] = (voronoi[i].centroid[0] + .5f) / (float) img.width();
-        voronoi[i].centroid[1] = (voronoi[i].centroid[1] + .5f) / (float) img.height();
+        voronoi[i].centroid[0] = (voronoi[i].centroid[0] + .5f) / (float) width;
+        voronoi[i].centroid[1] = (voronoi[i].centroid[1] + .5f) / (float) height;
     }
-
-    return voronoi;
-}
\ No newline at end of file
+}
@@ -0,0 +1,546 @@
+#include "vulkanContext.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <unistd.h>
+#include <utility>
+
+// every logical device of the policy, created on first use and kept until
+// exit, so later solvers skip instance and device creation; solvers hold
+// their own references, so contexts outlive any that are still alive
+struct ContextPool {
+  std::mutex mutex;
+  DevicePolicy policy;
+  std::vector<std::shared_ptr<VulkanContext>> contexts;
+};
+
+
+static ContextPool& GetContextPool() {
+  static ContextPool pool;
+  return pool;
+}
+
+
+static uint32_t ParseCount(const std::string& value) {
+  const int count = std::stoi(value);
+  if (count < 1) {
+    throw std::runtime_error("device policy counts must be positive!");
+  }
+
+  return static_cast<uint32_t>(count);
+}
+
+
+DevicePolicy DevicePolicy::Parse(const std::string& spec) {
+  DevicePolicy policy;
+  std::istringstream tokens(spec);
+  std::string token;
+
+  while (std::getline(tokens, token, ',')) {
+    const size_t split = token.find('=');
+    const std::string key = token.substr(0, split);
+    const std::string value = split == std::string::npos ? "" : token.substr(split + 1);
+
+    if (key == "discrete") {
+      policy.type = VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU;
+    }
+    else if (key == "integrated") {
+      policy.type = VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU;
+    }
+    else if (key == "virtual") {
+      policy.type = VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU;
+    }
+    else if (key == "cpu") {
+      policy.type = VK_PHYSICAL_DEVICE_TYPE_CPU;
+    }
+    else if (key == "index") {
+      policy.index = std::stoi(value);
+    }
+    else if (key == "name") {
+      policy.name = value;
+    }
+    else if (key == "devices") {
+      policy.devices = ParseCount(value);
+    }
+    else if (key == "queues") {
+      policy.queues = ParseCount(value);
+    }
+    else if (key == "report") {
+      policy.report = true;
+    }
+    else if (!key.empty()) {
+      throw std::runtime_error("unknown device policy '" + token + "'!");
+    }
+  }
+
+  return policy;
+}
+
+
+void VulkanContext::SetPolicy(const DevicePolicy& policy) {
+  ContextPool& pool = GetContextPool();
+  std::lock_guard<std::mutex> lock(pool.mutex);
+
+  if (!pool.contexts.empty()) {
+    throw std::runtime_error("the device policy must be set before the first solver!");
+  }
+
+  pool.policy = policy;
+}
+
+
+// fewest solvers attached now, then fewest so far, so jobs run one after
+// another still take every queue in turn
+static bool LessLoaded(const DeviceQueue& queue, const DeviceQueue* best) {
+  return best == nullptr || queue.active < best->active
+      || (queue.active == best->active && queue.jobs < best->jobs);
+}
+
+
+std::shared_ptr<VulkanContext> VulkanContext::Acquire(uint32_t* queueIndex) {
+  ContextPool& pool = GetContextPool();
+  std::lock_guard<std::mutex> lock(pool.mutex);
+
+  if (pool.contexts.empty()) {
+    if (!LoadVulkan()) {
+      throw std::runtime_error("no Vulkan loader found!");
+    }
+
+    std::shared_ptr<SharedInstance> sharedInstance = CreateInstance();
+    for (uint32_t i = 0; i < pool.policy.devices; i++) {
+      pool.contexts.push_back(std::shared_ptr<VulkanContext>(new VulkanContext(pool.policy, i, sharedInstance)));
+    }
+  }
+
+  std::shared_ptr<VulkanContext> chosen;
+  const DeviceQueue* best = nullptr;
+  for (const std::shared_ptr<VulkanContext>& context : pool.contexts) {
+    for (uint32_t i = 0; i < context->queues.size(); i++) {
+      const DeviceQueue& queue = context->queues[i];
+      if (LessLoaded(queue, best)) {
+        best = &queue;
+        chosen = context;
+        *queueIndex = i;
+      }
+    }
+  }
+
+  DeviceQueue& queue = chosen->queues[*queueIndex];
+  queue.active++;
+  queue.jobs++;
+  return chosen;
+}
+
+
+void VulkanContext::AcquireQueue(uint32_t* queueIndex) {
+  // a pooled solver's memory lives on this device, only its queue can move
+  std::lock_guard<std::mutex> lock(GetContextPool().mutex);
+
+  const DeviceQueue* best = nullptr;
+  for (uint32_t i = 0; i < queues.size(); i++) {
+    if (LessLoaded(queues[i], best)) {
+      best = &queues[i];
+      *queueIndex = i;
+    }
+  }
+
+  queues[*queueIndex].active++;
+  queues[*queueIndex].jobs++;
+}
+
+
+uint32_t VulkanContext::LeastActive() {
+  uint32_t least = std::numeric_limits<uint32_t>::max();
+  for (const DeviceQueue& queue : queues) {
+    least = std::min<uint32_t>(least, queue.active);
+  }
+
+  return least;
+}
+
+
+uint32_t VulkanContext::LeastActiveOverall() {
+  ContextPool& pool = GetContextPool();
+  std::lock_guard<std::mutex> lock(pool.mutex);
+
+  // before the first solver every queue is free
+  uint32_t least = pool.contexts.empty() ? 0 : std::numeric_limits<uint32_t>::max();
+  for (const std::shared_ptr<VulkanContext>& context : pool.contexts) {
+    least = std::min(least, context->LeastActive());
+  }
+
+  return least;
+}
+
+
+void VulkanContext::Release(uint32_t queueIndex) {
+  // without the pool's lock, solvers kept in static pools are destroyed
+  // after the context pool itself
+  queues[queueIndex].active--;
+}
+
+
+VulkanContext::VulkanContext(const DevicePolicy& policy, uint32_t _ordinal, std::shared_ptr<SharedInstance> _sharedInstance)
+  : sharedInstance(std::move(_sharedInstance)) {
+  ordinal = _ordinal;
+  report = policy.report || policy.devices * policy.queues > 1;
+  created = std::chrono::steady_clock::now();
+  instance = sharedInstance->instance;
+
+  CreateDevice(policy);
+
+  // entry points of the only device dispatch straight to its driver; with
+  // several, those resolved through the instance serve every one of them
+  if (policy.devices == 1) {
+    LoadVulkanDevice(device);
+  }
+
+  allocator.Init(physicalDevice, device);
+  CreatePipelineCache();
+}
+
+
+VulkanContext::~VulkanContext() {
+  if (report) {
+    ReportThroughput();
+  }
+
+  SavePipelineCache();
+  vkDestroyPipelineCache(device, pipelineCache, nullptr);
+  allocator.Release();
+  vkDestroyDevice(device, nullptr);
+}
+
+
+SharedInstance::~SharedInstance() {
+  if (debugReportCallback != VK_NULL_HANDLE) {
+    auto vkDestroyDebugReportCallbackEXT = reinterpret_cast<PFN_vkDestroyDebugReportCallbackEXT>(vkGetInstanceProcAddr(instance, "vkDestroyDebugReportCallbackEXT"));
+    vkDestroyDebugReportCallbackEXT(instance, debugReportCallback, nullptr);
+  }
+
+  vkDestroyInstance(instance, nullptr);
+}
+
+
+void VulkanContext::Submit(const VkSubmitInfo& submitInfo, VkFence fence, uint32_t queueIndex) {
+  // queues are externally synchronised, several solvers may share one
+  DeviceQueue& deviceQueue = queues[queueIndex];
+  std::lock_guard<std::mutex> lock(deviceQueue.mutex);
+  VK_CHECK_RESULT(vkQueueSubmit(deviceQueue.queue, 1, &submitInfo, fence))
+  deviceQueue.submissions++;
+}
+
+
+void VulkanContext::AddDeviceTime(uint32_t queueIndex, double milliseconds) {
+  DeviceQueue& deviceQueue = queues[queueIndex];
+  std::lock_guard<std::mutex> lock(deviceQueue.mutex);
+  deviceQueue.busy += milliseconds;
+}
+
+
+void VulkanContext::ReportThroughput() {
+  VkPhysicalDeviceProperties deviceProperties;
+  vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+
+  const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - created).count();
+
+  for (uint32_t i = 0; i < queues.size(); i++) {
+    const DeviceQueue& deviceQueue = queues[i];
+    std::cout << "device " << ordinal << " queue " << i << " (" << deviceProperties.deviceName << "): "
+      << deviceQueue.jobs << " jobs, " << deviceQueue.submissions << " submissions, "
+      << std::fixed << std::setprecision(1) << deviceQueue.busy << " ms busy over " << seconds << " s, "
+      << std::setprecision(2) << deviceQueue.jobs / std::max(seconds, 1e-9) << " jobs/s" << std::endl;
+  }
+}
+
+
+std::shared_ptr<SharedInstance> VulkanContext::CreateInstance() {
+  std::shared_ptr<SharedInstance> shared = std::make_shared<SharedInstance>();
+  const char* validationLayers[] = { "VK_LAYER_LUNARG_standard_validation" };
+  uint32_t layerCount = 0;
+
+  // Check if layers are available
+  uint32_t instanceLayerCount;
+  vkEnumerateInstanceLayerProperties(&instanceLayerCount, nullptr);
+  std::vector<VkLayerProperties> instanceLayers(instanceLayerCount);
+  vkEnumerateInstanceLayerProperties(&instanceLayerCount, instanceLayers.data());
+
+  VkApplicationInfo appInfo = {};
+  appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+  // TODO: this should be configurable?
+  appInfo.pApplicationName = "Vulkan headless example";
+  appInfo.pEngineName = "VulkanExample";
+  appInfo.apiVersion = VK_API_VERSION_1_1; // for vkGetPhysicalDeviceFeatures2
+
+  VkInstanceCreateInfo instanceCreateInfo = {};
+  instanceCreateInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+  instanceCreateInfo.pApplicationInfo = &appInfo;
+
+  bool layersAvailable = true;
+  bool layerAvailable;
+  for (auto layerName : validationLayers) {
+    layerAvailable = false;
+    for (auto instanceLayer : instanceLayers) {
+      if (strcmp(instanceLayer.layerName, layerName) == 0) {
+        layerAvailable = true;
+        break;
+      }
+    }
+
+    // If any layer is missing, configuration can't be used
+    if (!layerAvailable) {
+      layersAvailable = false;
+      break;
+    }
+  }
+
+  if (layersAvailable) {
+    instanceCreateInfo.ppEnabledLayerNames = validationLayers;
+    const char *validationExt = VK_EXT_DEBUG_REPORT_EXTENSION_NAME;
+    instanceCreateInfo.enabledLayerCount = layerCount;
+    instanceCreateInfo.enabledExtensionCount = 1;
+    instanceCreateInfo.ppEnabledExtensionNames = &validationExt;
+  }
+
+  VK_CHECK_RESULT(vkCreateInstance(&instanceCreateInfo, nullptr, &shared->instance))
+  LoadVulkanInstance(shared->instance);
+
+    if (layersAvailable) {
+      VkDebugReportCallbackCreateInfoEXT debugReportCreateInfo = {};
+      debugReportCreateInfo.sType = VK_STRUCTURE_TYPE_DEBUG_REPORT_CALLBACK_CREATE_INFO_EXT;
+      debugReportCreateInfo.flags = VK_DEBUG_REPORT_ERROR_BIT_EXT | VK_DEBUG_REPORT_WARNING_BIT_EXT;
+      debugReportCreateInfo.pfnCallback = (PFN_vkDebugReportCallbackEXT)debugMessageCallback;
+
+      // We have to explicitly load this function.
+      auto vkCreateDebugReportCallbackEXT = reinterpret_cast<PFN_vkCreateDebugReportCallbackEXT>(vkGetInstanceProcAddr(shared->instance, "vkCreateDebugReportCallbackEXT"));
+      assert(vkCreateDebugReportCallbackEXT);
+      VK_CHECK_RESULT(vkCreateDebugReportCallbackEXT(shared->instance, &debugReportCreateInfo, nullptr, &shared->debugReportCallback))
+    }
+
+  return shared;
+}
+
+
+static uint32_t DeviceTypeRank(VkPhysicalDeviceType type) {
+  switch (type) {
+    case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU: return 0;
+    case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU: return 1;
+    case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU: return 2;
+    case VK_PHYSICAL_DEVICE_TYPE_CPU: return 3;
+    default: return 4;
+  }
+}
+
+
+void VulkanContext::CreateDevice(const DevicePolicy& policy) {
+  uint32_t deviceCount = 0;
+
+  VK_CHECK_RESULT(vkEnumeratePhysicalDevices(instance, &deviceCount, nullptr))
+    std::vector<VkPhysicalDevice> physicalDevices(deviceCount);
+
+  VK_CHECK_RESULT(vkEnumeratePhysicalDevices(instance, &deviceCount, physicalDevices.data()))
+
+  // every device the policy allows, fastest kind first; logical devices
+  // beyond the number of matches share physical devices in turn
+  std::vector<std::pair<uint32_t, VkPhysicalDevice>> candidates;
+  for (uint32_t i = 0; i < deviceCount; i++) {
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevices[i], &properties);
+
+    if ((policy.index >= 0 && static_cast<uint32_t>(policy.index) != i)
+        || (policy.type && properties.deviceType != *policy.type)
+        || (!policy.name.empty() && strstr(properties.deviceName, policy.name.c_str()) == nullptr)) {
+      continue;
+    }
+
+    candidates.emplace_back(DeviceTypeRank(properties.deviceType), physicalDevices[i]);
+  }
+
+  if (candidates.empty()) {
+    throw std::runtime_error("no physical device matches the device policy!");
+  }
+
+  std::stable_sort(candidates.begin(), candidates.end(),
+      [](const auto& a, const auto& b) { return a.first < b.first; });
+  physicalDevice = candidates[ordinal % candidates.size()].second;
+
+  VkPhysicalDeviceProperties deviceProperties;
+  vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+  std::cout << "device " << ordinal << ": " << deviceProperties.deviceName << std::endl;
+
+  // Request as many graphics queues as the policy asks for and the family has
+  std::vector<float> queuePriorities;
+  VkDeviceQueueCreateInfo queueCreateInfo = {};
+  uint32_t queueFamilyCount;
+  vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+  std::vector<VkQueueFamilyProperties> queueFamilyProperties(queueFamilyCount);
+  vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilyProperties.data());
+
+  for (uint32_t i = 0; i < static_cast<uint32_t>(queueFamilyProperties.size()); i++) {
+    if (queueFamilyProperties[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) {
+      queueFamilyIndex = i;
+      queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+      queueCreateInfo.queueFamilyIndex = i;
+      queuePriorities.resize(std::min(policy.queues, queueFamilyProperties[i].queueCount), 0.0f);
+      queueCreateInfo.queueCount = static_cast<uint32_t>(queuePriorities.size());
+      queueCreateInfo.pQueuePriorities = queuePriorities.data();
+      break;
+    }
+  }
+
+  VkDeviceCreateInfo deviceCreateInfo = {};
+  deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+  deviceCreateInfo.queueCreateInfoCount = 1;
+  deviceCreateInfo.pQueueCreateInfos = &queueCreateInfo;
+
+  // float atomics let moments be reduced on the device, without them the
+  // label image is read back and reduced on the host
+  uint32_t extensionCount = 0;
+  vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, nullptr);
+  std::vector<VkExtensionProperties> extensions(extensionCount);
+  vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, extensions.data());
+
+  VkPhysicalDeviceShaderAtomicFloatFeaturesEXT atomicFloatFeatures = {};
+  atomicFloatFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SHADER_ATOMIC_FLOAT_FEATURES_EXT;
+  const char* atomicFloatExt = VK_EXT_SHADER_ATOMIC_FLOAT_EXTENSION_NAME;
+
+  // writing gl_Layer from the vertex shader lets one draw fill every layer
+  // of a batched framebuffer
+  const char* layerOutputExt = VK_EXT_SHADER_VIEWPORT_INDEX_LAYER_EXTENSION_NAME;
+
+  std::vector<const char*> enabledExtensions;
+  for (const VkExtensionProperties& extension : extensions) {
+    if (strcmp(extension.extensionName, atomicFloatExt) == 0) {
+      VkPhysicalDeviceFeatures2 features = {};
+      features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+      features.pNext = &atomicFloatFeatures;
+      vkGetPhysicalDeviceFeatures2(physicalDevice, &features);
+      floatAtomics = atomicFloatFeatures.shaderBufferFloat32AtomicAdd;
+    }
+    else if (strcmp(extension.extensionName, layerOutputExt) == 0) {
+      layerOutput = true;
+      enabledExtensions.push_back(layerOutputExt);
+    }
+  }
+
+  if (floatAtomics) {
+    enabledExtensions.push_back(atomicFloatExt);
+    deviceCreateInfo.pNext = &atomicFloatFeatures;
+  }
+
+  deviceCreateInfo.enabledExtensionCount = static_cast<uint32_t>(enabledExtensions.size());
+  deviceCreateInfo.ppEnabledExtensionNames = enabledExtensions.data();
+
+  VK_CHECK_RESULT(vkCreateDevice(physicalDevice, &deviceCreateInfo, nullptr, &device))
+
+  for (uint32_t i = 0; i < queueCreateInfo.queueCount; i++) {
+    queues.emplace_back();
+    vkGetDeviceQueue(device, queueFamilyIndex, i, &queues.back().queue);
+  }
+}
+
+
+std::string VulkanContext::GetPipelineCacheDir() {
+  // empty variables count as unset, as the XDG base directory spec has it
+  const char* path = std::getenv(PIPELINE_CACHE_ENV);
+  if (path != nullptr && *path != '\0') {
+    return (std::filesystem::path(path) / "").string();
+  }
+
+  const char* cacheHome = std::getenv("XDG_CACHE_HOME");
+  if (cacheHome != nullptr && *cacheHome != '\0') {
+    return (std::filesystem::path(cacheHome) / PIPELINE_CACHE_APP / "").string();
+  }
+
+  const char* home = std::getenv("HOME");
+  if (home != nullptr && *home != '\0') {
+    return (std::filesystem::path(home) / ".cache" / PIPELINE_CACHE_APP / "").string();
+  }
+
+  return PIPELINE_CACHE_PATH;
+}
+
+
+void VulkanContext::CreatePipelineCache() {
+  // cache data is only valid for the device and driver that wrote it, so the
+  // file is named for both
+  VkPhysicalDeviceProperties deviceProperties;
+  vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+
+  pipelineCacheDir = GetPipelineCacheDir();
+  std::ostringstream name;
+  name << pipelineCacheDir << "pipelines-" << std::hex << std::setfill('0');
+  for (uint8_t byte : deviceProperties.pipelineCacheUUID) {
+    name << std::setw(2) << static_cast<uint32_t>(byte);
+  }
+  name << "-" << std::setw(8) << deviceProperties.driverVersion << ".bin";
+  pipelineCacheFile = name.str();
+
+  std::vector<char> data;
+  std::ifstream file(pipelineCacheFile, std::ios::ate | std::ios::binary);
+  if (file.is_open()) {
+    data.resize(static_cast<size_t>(file.tellg()));
+    file.seekg(0);
+    file.read(data.data(), data.size());
+  }
+
+  // the header must match this device, anything else starts an empty cache;
+  // drivers check again and ignore data they cannot use
+  const size_t headerSize = 16 + VK_UUID_SIZE;
+  uint32_t header[4] = {};
+  if (data.size() >= headerSize) {
+    memcpy(header, data.data(), sizeof(header));
+  }
+
+  if (data.size() < headerSize
+      || header[0] < headerSize
+      || header[1] != VK_PIPELINE_CACHE_HEADER_VERSION_ONE
+      || header[2] != deviceProperties.vendorID
+      || header[3] != deviceProperties.deviceID
+      || memcmp(data.data() + 16, deviceProperties.pipelineCacheUUID, VK_UUID_SIZE) != 0) {
+    data.clear();
+  }
+
+  VkPipelineCacheCreateInfo pipelineCacheCreateInfo = {};
+  pipelineCacheCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+  pipelineCacheCreateInfo.initialDataSize = data.size();
+  pipelineCacheCreateInfo.pInitialData = data.empty() ? nullptr : data.data();
+  VK_CHECK_RESULT(vkCreatePipelineCache(device, &pipelineCacheCreateInfo, nullptr, &pipelineCache))
+}
+
+
+void VulkanContext::SavePipelineCache() {
+  size_t size = 0;
+  if (vkGetPipelineCacheData(device, pipelineCache, &size, nullptr) != VK_SUCCESS || size == 0) {
+    return;
+  }
+
+  std::vector<char> data(size);
+  if (vkGetPipelineCacheData(device, pipelineCache, &size, data.data()) != VK_SUCCESS) {
+    return;
+  }
+
+  // written aside and renamed over, so runs finishing together never leave a
+  // torn file; failing to save only costs the next run its head start
+  std::error_code error;
+  std::filesystem::create_directories(pipelineCacheDir, error);
+
+  const std::string partial = pipelineCacheFile + "." + std::to_string(getpid());
+  std::ofstream file(partial, std::ios::binary | std::ios::trunc);
+  if (!file.is_open()) {
+    return;
+  }
+
+  file.write(data.data(), size);
+  file.close();
+
+  if (!file || std::rename(partial.c_str(), pipelineCacheFile.c_str()) != 0) {
+    std::remove(partial.c_str());
+  }
+}
@@ -0,0 +1,100 @@
+#include "vulkanLoader.h"
+#include <dlfcn.h>
+
+#define VULKAN_DEFINE_FUNCTION(name) PFN_##name name = nullptr;
+PFN_vkGetInstanceProcAddr vkGetInstanceProcAddr = nullptr;
+VULKAN_GLOBAL_FUNCTIONS(VULKAN_DEFINE_FUNCTION)
+VULKAN_INSTANCE_FUNCTIONS(VULKAN_DEFINE_FUNCTION)
+VULKAN_DEVICE_FUNCTIONS(VULKAN_DEFINE_FUNCTION)
+#undef VULKAN_DEFINE_FUNCTION
+
+#if defined(__APPLE__)
+static const char* loaderNames[] = { "libvulkan.1.dylib", "libvulkan.dylib", "libMoltenVK.dylib" };
+#else
+static const char* loaderNames[] = { "libvulkan.so.1", "libvulkan.so" };
+#endif
+
+
+bool LoadVulkan() {
+  // the library stays open until exit, drivers may still be running
+  // destructors of their own by then
+  static bool loaded = [] {
+    void* library = nullptr;
+    for (const char* name : loaderNames) {
+      library = dlopen(name, RTLD_NOW | RTLD_LOCAL);
+      if (library != nullptr) {
+        break;
+      }
+    }
+
+    if (library == nullptr) {
+      return false;
+    }
+
+    vkGetInstanceProcAddr = reinterpret_cast<PFN_vkGetInstanceProcAddr>(dlsym(library, "vkGetInstanceProcAddr"));
+    if (vkGetInstanceProcAddr == nullptr) {
+      return false;
+    }
+
+#define VULKAN_LOAD_GLOBAL(name) name = reinterpret_cast<PFN_##name>(vkGetInstanceProcAddr(nullptr, #name));
+    VULKAN_GLOBAL_FUNCTIONS(VULKAN_LOAD_GLOBAL)
+#undef VULKAN_LOAD_GLOBAL
+
+    return vkCreateInstance != nullptr;
+  }();
+
+  return loaded;
+}
+
+
+void LoadVulkanInstance(VkInstance instance) {
+#define VULKAN_LOAD_INSTANCE(name) name = reinterpret_cast<PFN_##name>(vkGetInstanceProcAddr(instance, #name));
+  VULKAN_INSTANCE_FUNCTIONS(VULKAN_LOAD_INSTANCE)
+  VULKAN_DEVICE_FUNCTIONS(VULKAN_LOAD_INSTANCE)
+#undef VULKAN_LOAD_INSTANCE
+}
+
+
+void LoadVulkanDevice(VkDevice device) {
+#define VULKAN_LOAD_DEVICE(name) name = reinterpret_cast<PFN_##name>(vkGetDeviceProcAddr(device, #name));
+  VULKAN_DEVICE_FUNCTIONS(VULKAN_LOAD_DEVICE)
+#undef VULKAN_LOAD_DEVICE
+}
+
+
+bool VulkanDeviceAvailable() {
+  static bool available = [] {
+    if (!LoadVulkan()) {
+      return false;
+    }
+
+    VkApplicationInfo appInfo = {};
+    appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+    appInfo.apiVersion = VK_API_VERSION_1_1;
+
+    VkInstanceCreateInfo instanceCreateInfo = {};
+    instanceCreateInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+    instanceCreateInfo.pApplicationInfo = &appInfo;
+
+    VkInstance instance;
+    if (vkCreateInstance(&instanceCreateInfo, nullptr, &instance) != VK_SUCCESS) {
+      return false;
+    }
+
+    // fetched for this instance alone, it dies before any solver starts
+    auto enumeratePhysicalDevices = reinterpret_cast<PFN_vkEnumeratePhysicalDevices>(vkGetInstanceProcAddr(instance, "vkEnumeratePhysicalDevices"));
+    auto destroyInstance = reinterpret_cast<PFN_vkDestroyInstance>(vkGetInstanceProcAddr(instance, "vkDestroyInstance"));
+
+    if (enumeratePhysicalDevices == nullptr || destroyInstance == nullptr) {
+      return false;
+    }
+
+    uint32_t deviceCount = 0;
+    const VkResult result = enumeratePhysicalDevices(instance, &deviceCount, nullptr);
+    destroyInstance(instance, nullptr);
+
+    return result == VK_SUCCESS && deviceCount > 0;
+  }();
+
+  return available;
+}
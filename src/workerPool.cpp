@@ -0,0 +1,83 @@
+#include "workerPool.h"
+#include <algorithm>
+
+
+WorkerPool::WorkerPool(uint32_t size) {
+  if (size == 0) {
+    size = std::max(std::thread::hardware_concurrency(), 1u);
+  }
+
+  // the caller is the last worker
+  for (uint32_t i = 1; i < size; i++) {
+    threads.emplace_back(&WorkerPool::Run, this);
+  }
+}
+
+
+WorkerPool::~WorkerPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  start.notify_all();
+
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+}
+
+
+void WorkerPool::Work() {
+  for (uint32_t i = next++; i < count; i = next++) {
+    (*body)(i);
+  }
+}
+
+
+void WorkerPool::Run() {
+  uint64_t seen = 0;
+
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      start.wait(lock, [&]() { return stopping || generation != seen; });
+      if (stopping) {
+        return;
+      }
+      seen = generation;
+    }
+
+    Work();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (--busy == 0) {
+      done.notify_one();
+    }
+  }
+}
+
+
+void WorkerPool::ParallelFor(uint32_t _count, const std::function<void(uint32_t)>& _body) {
+  if (threads.empty() || _count <= 1) {
+    for (uint32_t i = 0; i < _count; i++) {
+      _body(i);
+    }
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    body = &_body;
+    count = _count;
+    next = 0;
+    busy = static_cast<uint32_t>(threads.size());
+    generation++;
+  }
+  start.notify_all();
+
+  Work();
+
+  // every worker has left the loop before the next one can be set up
+  std::unique_lock<std::mutex> lock(mutex);
+  done.wait(lock, [&]() { return busy == 0; });
+}
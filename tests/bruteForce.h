@@ -0,0 +1,104 @@
+#ifndef BRUTE_FORCE_H
+#define BRUTE_FORCE_H
+
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <vector>
+#include "CImg.h"
+#include "glm/glm.hpp"
+
+#define SPLIT_PAIR_SPREAD 1.0f // pixels, at most between the two sites of a split pair
+
+// shared by the check programs: the Voronoi diagram at pixel centres by
+// trying every site at every pixel, the lowest index winning a tie
+inline cimg_library::CImg<uint32_t> BruteForceLabels(const std::vector<glm::vec2>& points, int width, int height) {
+  cimg_library::CImg<uint32_t> labels(width, height, 1, 1);
+
+  for(int y = 0; y < height; y++) {
+    for(int x = 0; x < width; x++) {
+      double best = std::numeric_limits<double>::infinity();
+      uint32_t label = 0;
+
+      for(uint32_t i = 0; i < points.size(); i++) {
+        const double dx = x + 0.5 - static_cast<double>(points[i].x) * width;
+        const double dy = y + 0.5 - static_cast<double>(points[i].y) * height;
+        if(dx * dx + dy * dy < best) {
+          best = dx * dx + dy * dy;
+          label = i;
+        }
+      }
+
+      labels(x, y) = label;
+    }
+  }
+
+  return labels;
+}
+
+
+// from the centre of pixel (x, y) to a site, in pixels
+inline double SiteDistance(const std::vector<glm::vec2>& points, int width, int height, int x, int y, uint32_t label) {
+  const double dx = x + 0.5 - static_cast<double>(points[label].x) * width;
+  const double dy = y + 0.5 - static_cast<double>(points[label].y) * height;
+  return std::sqrt(dx * dx + dy * dy);
+}
+
+
+// one diagram to check: sites either scattered uniformly, or in pairs under
+// a pixel apart as LBG leaves them after splitting a cell
+struct CheckCase {
+  int width, height;
+  uint32_t count;
+  uint32_t seed;
+  bool splitPairs;
+};
+
+static const CheckCase CHECK_CASES[] = {
+  {97, 61, 50, 1, false},
+  {256, 256, 2000, 2, false},
+  {317, 190, 500, 3, false},
+  {32, 32, 2, 4, true},
+  {200, 150, 400, 5, true},
+};
+
+
+// the case's sites in [0, 1), the same for a given seed
+inline std::vector<glm::vec2> CheckSites(const CheckCase& check) {
+  std::mt19937 generator(check.seed);
+  std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+  std::uniform_real_distribution<float> spread(-0.5f * SPLIT_PAIR_SPREAD, 0.5f * SPLIT_PAIR_SPREAD);
+
+  std::vector<glm::vec2> points(check.count);
+  for(uint32_t i = 0; i < check.count; i++) {
+    if(check.splitPairs && i % 2 == 1) {
+      const glm::vec2 offset(spread(generator) / check.width, spread(generator) / check.height);
+      points[i] = glm::clamp(points[i - 1] + offset, glm::vec2(0.0f), glm::vec2(0.999f));
+    }
+    else {
+      points[i] = glm::vec2(uniform(generator), uniform(generator));
+    }
+  }
+
+  return points;
+}
+
+
+// runs every case through check and reports each as it goes; the exit status
+// of a check program
+template <typename Check>
+int RunChecks(const char* name, Check check) {
+  bool pass = true;
+
+  for(const CheckCase& c : CHECK_CASES) {
+    std::cout << name << " " << c.width << "x" << c.height << ", " << c.count
+              << (c.splitPairs ? " split pair" : "") << " sites: ";
+    pass = check(c, CheckSites(c)) && pass;
+  }
+
+  return pass ? 0 : 1;
+}
+
+#endif
@@ -0,0 +1,55 @@
+#include "edtVoronoi.h"
+#include "bruteForce.h"
+
+#define CHECK_SNAP_DISTANCE 1.4143 // pixels, two sites each moved by at most half a pixel diagonal
+
+// EDTVoronoi is exact for its seeds, the sites snapped to pixel centres: every
+// pixel's seed must be a nearest one of those, and the site behind it at most
+// the snapping farther than the nearest real site
+static bool CheckLabels(const CheckCase& check, const std::vector<glm::vec2>& points) {
+  // seeds in whole pixels, so their squared distances compare exactly
+  std::vector<glm::ivec2> seeds(points.size());
+  for(size_t i = 0; i < points.size(); i++) {
+    seeds[i] = glm::clamp(glm::ivec2(points[i] * glm::vec2(check.width, check.height)),
+                          glm::ivec2(0), glm::ivec2(check.width - 1, check.height - 1));
+  }
+
+  auto seedDistance = [&](int x, int y, uint32_t label) {
+    const int64_t dx = x - seeds[label].x;
+    const int64_t dy = y - seeds[label].y;
+    return dx * dx + dy * dy;
+  };
+
+  EDTVoronoi edt(check.width, check.height);
+  LabelMap map = edt.GetLabelMap(points);
+  cimg_library::CImg<uint32_t> nearestSite = BruteForceLabels(points, check.width, check.height);
+
+  size_t wrong = 0;
+  double worst = 0.0;
+  cimg_forXY(nearestSite, x, y) {
+    const uint32_t label = map.At(x, y);
+    if(label >= points.size()) {
+      wrong++;
+      continue;
+    }
+
+    int64_t nearest = std::numeric_limits<int64_t>::max();
+    for(uint32_t i = 0; i < points.size(); i++) {
+      nearest = std::min(nearest, seedDistance(x, y, i));
+    }
+    wrong += seedDistance(x, y, label) != nearest;
+
+    worst = std::max(worst, SiteDistance(points, check.width, check.height, x, y, label)
+                          - SiteDistance(points, check.width, check.height, x, y, nearestSite(x, y)));
+  }
+
+  const bool pass = wrong == 0 && worst <= CHECK_SNAP_DISTANCE;
+  std::cout << (pass ? "pass" : "FAIL") << ", " << wrong << " pixels not at a nearest seed, worst "
+            << worst << " px farther than the nearest site" << std::endl;
+  return pass;
+}
+
+
+int main() {
+  return RunChecks("edt", CheckLabels);
+}
@@ -0,0 +1,41 @@
+#include "exactVoronoi.h"
+#include "bruteForce.h"
+
+#define CHECK_TOLERANCE 1e-4 // relative, on every moment of every cell
+
+// ExactVoronoi::GetCells against the host reduction of a brute force label map
+static bool CheckCells(const CheckCase& check, const std::vector<glm::vec2>& points) {
+  std::mt19937 generator(check.seed);
+  std::uniform_int_distribution<int> intensity(0, 255);
+
+  // noise over a gradient, so every moment sees varying density
+  cimg_library::CImg<unsigned char> img(check.width, check.height, 1, 1);
+  cimg_forXY(img, x, y) {
+    img(x, y) = static_cast<unsigned char>((x * 255 / check.width + intensity(generator)) / 2);
+  }
+
+  ExactVoronoi exact(check.width, check.height);
+  exact.SetDensity(img);
+  std::vector<VoronoiCell> cells = exact.GetCells(points, {});
+  std::vector<VoronoiCell> reference = GetVoronoiCells(BruteForceLabels(points, check.width, check.height), img, points);
+
+  double worst = 0.0;
+  for(uint32_t i = 0; i < points.size(); i++) {
+    const float got[] = {cells[i].area, cells[i].m00, cells[i].m10, cells[i].m01, cells[i].m11, cells[i].m20, cells[i].m02};
+    const float want[] = {reference[i].area, reference[i].m00, reference[i].m10, reference[i].m01, reference[i].m11, reference[i].m20, reference[i].m02};
+
+    for(int k = 0; k < 7; k++) {
+      const double scale = std::max({std::abs(got[k]), std::abs(want[k]), 1.0f});
+      worst = std::max(worst, std::abs(got[k] - want[k]) / scale);
+    }
+  }
+
+  const bool pass = worst <= CHECK_TOLERANCE;
+  std::cout << (pass ? "pass" : "FAIL") << ", worst relative moment error " << worst << std::endl;
+  return pass;
+}
+
+
+int main() {
+  return RunChecks("exact", CheckCells);
+}
@@ -0,0 +1,60 @@
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <utility>
+#include <vector>
+#include "gpuVoronoi.h"
+
+// a software device will do, lavapipe exposes as many logical devices as
+// are asked for
+#define SPREAD_POLICY "cpu,devices=2,queues=2"
+#define SPREAD_SOLVERS 4
+#define SPREAD_SIZE 64
+
+// solvers alive at once must take every queue in turn, whether built new or
+// taken back out of the surface pool, and each must still render
+static bool CheckSpread(const char* round) {
+  std::vector<std::unique_ptr<GPUVoronoi>> solvers;
+  std::map<std::pair<uint32_t, uint32_t>, int> queues;
+  std::map<uint32_t, int> devices;
+
+  for(int i = 0; i < SPREAD_SOLVERS; i++) {
+    solvers.emplace_back(new GPUVoronoi(SPREAD_SIZE, SPREAD_SIZE));
+    const std::pair<uint32_t, uint32_t> queue = solvers.back()->GetQueue();
+    queues[queue]++;
+    devices[queue.first]++;
+  }
+
+  bool rendered = true;
+  for(const std::unique_ptr<GPUVoronoi>& solver : solvers) {
+    LabelMap map = solver->GetLabelMap({glm::vec2(0.25f, 0.25f), glm::vec2(0.75f, 0.75f)});
+    rendered = rendered && map.At(0, 0) == 0 && map.At(SPREAD_SIZE - 1, SPREAD_SIZE - 1) == 1;
+  }
+
+  int fewest = SPREAD_SOLVERS, most = 0;
+  for(const auto& queue : queues) {
+    fewest = std::min(fewest, queue.second);
+    most = std::max(most, queue.second);
+  }
+
+  // with no more queues than solvers, every queue is taken
+  const bool spread = devices.size() == 2 && most - fewest <= 1;
+
+  std::cout << round << ": " << SPREAD_SOLVERS << " solvers on " << devices.size() << " devices, "
+            << queues.size() << " queues, " << fewest << " to " << most << " solvers each, "
+            << (rendered ? "rendered" : "render FAILED") << ": " << (spread && rendered ? "pass" : "FAIL") << std::endl;
+
+  return spread && rendered;
+}
+
+
+int main() {
+  VulkanContext::SetPolicy(DevicePolicy::Parse(SPREAD_POLICY));
+
+  // the second round is served from the surfaces the first one pooled
+  bool pass = CheckSpread("new");
+  pass = CheckSpread("pooled") && pass;
+
+  return pass ? 0 : 1;
+}
@@ -0,0 +1,56 @@
+#include "tileVoronoi.h"
+#include "bruteForce.h"
+
+#define CHECK_TIE_DISTANCE 1e-3 // pixels, single precision may pick either site this close to a tie
+
+// every TileVoronoi kernel the host runs against the scalar one, which must
+// agree label for label, and the scalar one against brute force, which
+// differs only where two sites are all but equally near
+static bool CheckLabels(const CheckCase& check, const std::vector<glm::vec2>& points) {
+  cimg_library::CImg<uint32_t> reference = BruteForceLabels(points, check.width, check.height);
+
+  TileVoronoi tiles(check.width, check.height);
+  tiles.SetKernel("scalar");
+  cimg_library::CImg<uint32_t> scalar = tiles.GetImage(points);
+
+  size_t ties = 0, wrong = 0;
+  cimg_forXY(scalar, x, y) {
+    if(scalar(x, y) == reference(x, y)) continue;
+
+    if(scalar(x, y) < points.size()
+        && SiteDistance(points, check.width, check.height, x, y, scalar(x, y))
+         - SiteDistance(points, check.width, check.height, x, y, reference(x, y)) <= CHECK_TIE_DISTANCE) {
+      ties++;
+    }
+    else {
+      wrong++;
+    }
+  }
+
+  bool pass = wrong == 0;
+  std::cout << (pass ? "pass" : "FAIL") << ", scalar " << wrong << " pixels wrong, " << ties << " near ties";
+
+  for(const char* name : {"avx2", "avx512"}) {
+    if(!tiles.SetKernel(name)) {
+      std::cout << ", " << name << " not supported here";
+      continue;
+    }
+
+    cimg_library::CImg<uint32_t> vector = tiles.GetImage(points);
+    size_t differ = 0;
+    cimg_forXY(vector, x, y) {
+      differ += vector(x, y) != scalar(x, y);
+    }
+
+    std::cout << ", " << name << " " << differ << " pixels differ from scalar";
+    pass = pass && differ == 0;
+  }
+
+  std::cout << std::endl;
+  return pass;
+}
+
+
+int main() {
+  return RunChecks("tiles", CheckLabels);
+}